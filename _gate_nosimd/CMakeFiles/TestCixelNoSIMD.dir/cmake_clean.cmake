@@ -0,0 +1,13 @@
+file(REMOVE_RECURSE
+  "/root/repo/test/bin/TestCixelNoSIMD"
+  "/root/repo/test/bin/TestCixelNoSIMD.pdb"
+  "CMakeFiles/TestCixelNoSIMD.dir/main.cpp.o"
+  "CMakeFiles/TestCixelNoSIMD.dir/main.cpp.o.d"
+  "CMakeFiles/TestCixelNoSIMD.dir/test.cpp.o"
+  "CMakeFiles/TestCixelNoSIMD.dir/test.cpp.o.d"
+)
+
+# Per-language clean rules from dependency scanning.
+foreach(lang CXX)
+  include(CMakeFiles/TestCixelNoSIMD.dir/cmake_clean_${lang}.cmake OPTIONAL)
+endforeach()
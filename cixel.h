@@ -50,22 +50,32 @@ Put '#define CIXEL_IMPLEMENTATION' before including this file to create the impl
 #include <math.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <sys/stat.h>
 
 #ifndef __cplusplus
 #include <stdbool.h>
 #endif
 
-#if defined(__AVX__) || defined(__AVX2__)
+// Define CIXEL_NO_SIMD to use only scalar code
+#if !defined(CIXEL_NO_SIMD) && (defined(__AVX__) || defined(__AVX2__))
 #    define CIXEL_SSE (1)
 #endif
+// Kernels for SSE4.1 and AVX2 are selected at runtime on x86
+#if !defined(CIXEL_NO_SIMD) && (defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86))
+#    define CIXEL_X86 (1)
+#endif
 #if defined(__ARM_NEON) || defined(__ARM_NEON__)
 #    define CIXEL_NEON (1)
 #endif
 
-#if defined(CIXEL_SSE)
+#if defined(CIXEL_SSE) || defined(CIXEL_X86)
 #    include <immintrin.h>
 #endif
+#if defined(_MSC_VER)
+#    include <intrin.h>
+#endif
 
 #ifdef __cplusplus
 #define CIXEL_NAMESPACE_BEGIN(name) namespace name {
@@ -110,6 +120,30 @@ CIXEL_NAMESPACE_BEGIN(cixel)
 #    define CIXEL_RESTRICT __restrict__
 #endif
 
+#if defined(_MSC_VER) && !defined(__clang__)
+#    define CIXEL_TARGET_SSE41
+#    define CIXEL_TARGET_AVX2
+#else
+#    define CIXEL_TARGET_SSE41 __attribute__((target("sse4.1")))
+#    define CIXEL_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+// Atomics for progress shared between jobs
+#if defined(_MSC_VER) && !defined(__clang__)
+#    define CIXEL_ATOMIC_LOAD(ptr) _InterlockedOr((volatile long*)(ptr), 0)
+#    define CIXEL_ATOMIC_STORE(ptr, value) _InterlockedExchange((volatile long*)(ptr), (value))
+#    define CIXEL_ATOMIC_FETCH_ADD(ptr, value) _InterlockedExchangeAdd((volatile long*)(ptr), (value))
+#else
+#    define CIXEL_ATOMIC_LOAD(ptr) __atomic_load_n((ptr), __ATOMIC_ACQUIRE)
+#    define CIXEL_ATOMIC_STORE(ptr, value) __atomic_store_n((ptr), (value), __ATOMIC_RELEASE)
+#    define CIXEL_ATOMIC_FETCH_ADD(ptr, value) __atomic_fetch_add((ptr), (value), __ATOMIC_ACQ_REL)
+#endif
+#if defined(CIXEL_X86)
+#    define CIXEL_PAUSE() _mm_pause()
+#else
+#    define CIXEL_PAUSE()
+#endif
+
 #ifndef CIXEL_TYPES
 #    define CIXEL_TYPES
 typedef int8_t cixel_s8;
@@ -151,6 +185,54 @@ constexpr uintptr_t ALIGN_MASK = ~ALIGN_OFFSET;
 typedef void* (*AllocFunc)(cixel_size_t);
 typedef void (*FreeFunc)(void*);
 
+/**
+@brief A job which processes a part of the work
+@param [in] args ... arguments shared by all jobs
+@param [in] index ... index of this job, in [0, count)
+*/
+typedef void (*JobFunc)(void* args, cixel_s32 index);
+
+/**
+@brief Runs job(args, i) for each i in [0, count), and returns after all of them have finished
+@param [in] job ... a job
+@param [in] args ... arguments passed to the job
+@param [in] count ... number of jobs
+@param [in] userData ... user data given to cixelSetParallel
+*/
+typedef void (*ParallelFunc)(JobFunc job, void* args, cixel_s32 count, void* userData);
+
+/**
+@brief Receives encoded sixels in order, the data is valid only during the call
+@param [in] data ... encoded bytes
+@param [in] size ... number of bytes
+@param [in] userData ... user data given to cixelPrintTo
+*/
+typedef void (*WriteFunc)(const void* data, cixel_size_t size, void* userData);
+
+/**
+@brief Method to map pixels to a pallet
+*/
+enum Dither_t
+{
+    Dither_FloydSteinberg = 0, //< serpentine error diffusion
+    Dither_FloydSteinbergRaster, //< left to right error diffusion, which runs rows as a wavefront in parallel
+    Dither_FloydSteinbergStrips, //< serpentine error diffusion in independent strips of rows, which scales with threads but may show faint seams
+    Dither_Ordered, //< 8x8 Bayer matrix, which is independent between pixels and stable between frames
+};
+
+typedef enum Dither_t Dither;
+
+/**
+@brief Options of a context, which change the size of its workspace
+*/
+enum Option_t
+{
+    Option_None = 0,
+    Option_QuantizeOnly = 0x01U, //< no buffers to print sixels, indices are encoded elsewhere, e.g. by CixelEncoder
+};
+
+typedef enum Option_t Option;
+
 //--- Utility functions
 //-----------------------------------------------------------
 #ifdef __cplusplus
@@ -204,15 +286,15 @@ struct Color32_t
 
 typedef struct Color32_t Color32;
 
-struct ColorS32_t
+struct ColorS16_t
 {
-    cixel_s32 r_;
-    cixel_s32 g_;
-    cixel_s32 b_;
-    cixel_s32 a_;
+    cixel_s16 r_;
+    cixel_s16 g_;
+    cixel_s16 b_;
+    cixel_s16 a_;
 };
 
-typedef struct ColorS32_t ColorS32;
+typedef struct ColorS16_t ColorS16;
 
 struct PointU8_t
 {
@@ -232,6 +314,13 @@ struct BoxU8_t
 
 typedef struct BoxU8_t BoxU8;
 
+/**
+@brief Priority of a box to be split next by median cut, the box with the highest priority is split first
+@param [in] box ... a box in the quantized YUV space
+@param [in] frequency ... number of pixels in the box
+*/
+typedef cixel_u32 (*PriorityFunc)(const BoxU8* box, cixel_u32 frequency);
+
 //-----------------------------------------------------------
 //---
 //--- Sixel
@@ -240,6 +329,20 @@ typedef struct BoxU8_t BoxU8;
 struct Cixel_t;
 typedef struct Cixel_t Cixel;
 
+struct CixelEncoder_t;
+typedef struct CixelEncoder_t CixelEncoder;
+
+/**
+@brief Colors of a pallet in RGB, which an encoder takes apart from a quantizer
+*/
+struct Pallet_t
+{
+    cixel_s32 size_; //< number of colors
+    Color colors_[MAX_COLORS];
+};
+
+typedef struct Pallet_t Pallet;
+
 /**
 @brief 
 @param [in] width ... width of image
@@ -249,14 +352,165 @@ typedef struct Cixel_t Cixel;
 @note allocFunc and freeFunc should be assigned appropriately
 */
 Cixel* cixelCreate(cixel_s32 width, cixel_s32 height, AllocFunc allocFunc, FreeFunc freeFunc);
+
+/**
+@brief Create a context which has only the buffers its options need
+@param [in] options ... bitwise or of Option
+*/
+Cixel* cixelCreateWithOptions(cixel_s32 width, cixel_s32 height, cixel_u32 options, AllocFunc allocFunc, FreeFunc freeFunc);
+
+/**
+@brief Size of memory which cixelCreateInPlace needs, including the context itself and slack for alignment
+@param [in] width ... width of image
+@param [in] height ... height of image
+@param [in] options ... bitwise or of Option
+*/
+cixel_size_t cixelGetWorkspaceSize(cixel_s32 width, cixel_s32 height, cixel_u32 options);
+
+/**
+@brief Change the size of image, the workspace is reused if the new size fits, otherwise grows geometrically
+@param [in] width ... width of image
+@param [in] height ... height of image
+@return the context, which may move, CIXEL_NULL if failed to grow, then the context is left as it was
+@note A context in memory of the caller cannot grow,
+and multithreading is disabled if failed to allocate work of threads for a larger image
+*/
+Cixel* cixelResize(Cixel* cixel, cixel_s32 width, cixel_s32 height);
+
+/**
+@brief Create a context in memory of the caller, which is not freed by cixelDestroy
+@param [in] workspace ... memory of at least cixelGetWorkspaceSize bytes
+@param [in] size ... size of the workspace
+@param [in] options ... bitwise or of Option, the same as cixelGetWorkspaceSize
+@param [in] allocFunc ... allocation for work of threads, see cixelSetParallel
+@param [in] freeFunc ... deallocation for work of threads
+@return CIXEL_NULL if the workspace is too small
+*/
+Cixel* cixelCreateInPlace(void* workspace, cixel_size_t size, cixel_s32 width, cixel_s32 height, cixel_u32 options, AllocFunc allocFunc, FreeFunc freeFunc);
 void cixelDestroy(Cixel* cixel);
 
+/**
+@brief Enable multithreaded processing
+@param [in] numThreads ... number of jobs run at once, less than or equal to 1 disables multithreading
+@param [in] parallelFunc ... runs jobs, see ParallelFunc
+@param [in] userData ... passed to parallelFunc
+@return false if failed to allocate work memory for threads
+@note Each thread accumulates a private histogram, which needs about 720 KB per thread,
+and encodes bands of sixels into a private buffer, which needs about 256 bytes per column per thread
+*/
+bool cixelSetParallel(Cixel* cixel, cixel_s32 numThreads, ParallelFunc parallelFunc, void* userData);
+
+/**
+@brief Set the priority of median cut
+@param [in] priorityFunc ... priority of a box, CIXEL_NULL uses the frequency of the box
+*/
+void cixelSetPriority(Cixel* cixel, PriorityFunc priorityFunc);
+
+/**
+@brief Set the maximum number of colors in a pallet
+@param [in] maxColors ... clamped to [1, MAX_COLORS], MAX_COLORS by default
+*/
+void cixelSetMaxColors(Cixel* cixel, cixel_s32 maxColors);
+
+/**
+@brief Set the method to map pixels to a pallet, Dither_FloydSteinberg by default
+*/
+void cixelSetDither(Cixel* cixel, Dither dither);
+
 void cixelQuantize(Cixel* cixel, cixel_u8* CIXEL_RESTRICT indices, const cixel_u32* CIXEL_RESTRICT pixels, bool flipVertical);
 void cixelPrint(Cixel* cixel, FILE* file, const cixel_u8* CIXEL_RESTRICT indices);
 
+/**
+@brief Encode sixels, which are passed to writeFunc whenever the internal buffer is full
+@param [in] writeFunc ... receives encoded bytes, see WriteFunc
+@param [in] userData ... passed to writeFunc
+*/
+void cixelPrintTo(Cixel* cixel, WriteFunc writeFunc, void* userData, const cixel_u8* CIXEL_RESTRICT indices);
+
+/**
+@brief Encode sixels into a buffer of the caller
+@param [out] buffer ... encoded bytes, can be CIXEL_NULL if capacity is 0
+@param [in] capacity ... size of the buffer
+@return number of bytes of the whole sixels, the output was truncated if it is greater than capacity
+@note Sixels are encoded in place while they fit, and only the rest goes through the internal buffer
+*/
+cixel_size_t cixelPrintToMemory(Cixel* cixel, cixel_u8* buffer, cixel_size_t capacity, const cixel_u8* CIXEL_RESTRICT indices);
+
 Color cixelGetPalletColor(const Cixel* cixel, cixel_s32 index);
 
+/**
+@brief Copy the pallet of the last quantization, then the next quantization can run while an encoder prints indices with the copy
+@param [out] pallet ... colors in RGB
+*/
+void cixelGetPallet(const Cixel* cixel, Pallet* pallet);
+
+/**
+@brief An encoder of sixels, which has its own buffers, and can run in parallel with quantization of a next frame
+@param [in] width ... width of image
+@param [in] height ... height of image
+@param [in] allocFunc ... custom memory allocation
+@param [in] freeFunc ... custom memory deallocation
+@note An encoder has no tables of quantization, it needs about 80 KB besides a row of the image
+*/
+CixelEncoder* cixelEncoderCreate(cixel_s32 width, cixel_s32 height, AllocFunc allocFunc, FreeFunc freeFunc);
+
+/**
+@brief Size of memory which cixelEncoderCreateInPlace needs, see cixelGetWorkspaceSize
+*/
+cixel_size_t cixelEncoderGetWorkspaceSize(cixel_s32 width, cixel_s32 height);
+
+/**
+@brief Create an encoder in memory of the caller, which is not freed by cixelEncoderDestroy, see cixelCreateInPlace
+@return CIXEL_NULL if the workspace is too small
+*/
+CixelEncoder* cixelEncoderCreateInPlace(void* workspace, cixel_size_t size, cixel_s32 width, cixel_s32 height, AllocFunc allocFunc, FreeFunc freeFunc);
+void cixelEncoderDestroy(CixelEncoder* encoder);
+
+/**
+@brief Encode bands of sixels in parallel, see cixelSetParallel
+@return false if failed to allocate work memory for threads
+*/
+bool cixelEncoderSetParallel(CixelEncoder* encoder, cixel_s32 numThreads, ParallelFunc parallelFunc, void* userData);
+
+/**
+@brief Encode sixels with a pallet, see cixelPrintTo
+@param [in] pallet ... colors of indices in RGB
+*/
+void cixelEncode(CixelEncoder* encoder, const Pallet* pallet, WriteFunc writeFunc, void* userData, const cixel_u8* CIXEL_RESTRICT indices);
+
+/**
+@brief Encode sixels with a pallet into a buffer of the caller, see cixelPrintToMemory
+@param [in] pallet ... colors of indices in RGB
+*/
+cixel_size_t cixelEncodeToMemory(CixelEncoder* encoder, const Pallet* pallet, cixel_u8* buffer, cixel_size_t capacity, const cixel_u8* CIXEL_RESTRICT indices);
+
+/**
+@brief Encode indices which are not quantized by cixel, e.g. a pallet PNG or a GIF frame
+@param [in] width ... width of indices, less than or equal to the width of the encoder
+@param [in] height ... height of indices, which can be any
+@param [in] pallet ... colors in RGBA, the same order as pixels of cixelQuantize, alpha is ignored
+@param [in] numColors ... number of colors in [0, MAX_COLORS], every index should be less than it
+*/
+void cixelEncodeIndexed(CixelEncoder* encoder, cixel_s32 width, cixel_s32 height, const cixel_u32* pallet, cixel_s32 numColors, WriteFunc writeFunc, void* userData, const cixel_u8* CIXEL_RESTRICT indices);
+
+/**
+@brief Encode indices which are not quantized by cixel into a buffer of the caller, see cixelEncodeIndexed and cixelPrintToMemory
+*/
+cixel_size_t cixelEncodeIndexedToMemory(CixelEncoder* encoder, cixel_s32 width, cixel_s32 height, const cixel_u32* pallet, cixel_s32 numColors, cixel_u8* buffer, cixel_size_t capacity, const cixel_u8* CIXEL_RESTRICT indices);
+
+/**
+@brief Convert a pixel with fixed-point arithmetic, which is the same as cixelRGB2YUVRow
+*/
 cixel_u32 cixelRGB2YUV(cixel_u32 rgba);
+
+/**
+@brief Convert a row of pixels with fixed-point arithmetic
+@param [out] yuva ... converted pixels
+@param [in] rgba ... source pixels
+@param [in] count ... number of pixels
+@note The results are the same as cixelRGB2YUV on every platform
+*/
+void cixelRGB2YUVRow(cixel_u32* CIXEL_RESTRICT yuva, const cixel_u32* CIXEL_RESTRICT rgba, cixel_s32 count);
 cixel_u32 cixelYUV2RGB(cixel_u32 yuva);
 
 CIXEL_NAMESPACE_END(cixel)
@@ -331,75 +585,6 @@ CIXEL_STATIC inline void subColor32(Color32* c0, const Color32* c1)
         return (x < 256) ? CIXEL_STATIC_CAST(cixel_u8)(x) : 255;
     }
 
-#if defined(CIXEL_SSE)
-    constexpr cixel_u32 align16(cixel_u32 size)
-    {
-        return (size + 15U) & ~15U;
-    }
-
-    template<cixel_u32 SIZE>
-    void setZero16(void* CIXEL_RESTRICT ptr)
-    {
-        constexpr cixel_u32 total = (SIZE >> 4);
-        constexpr cixel_u32 count = total >> 2;
-        constexpr cixel_u32 remain = total - (count << 2);
-
-        __m128* p = reinterpret_cast<__m128*>(ptr);
-        __m128 zero = _mm_setzero_ps();
-        for(cixel_u32 i = 0; i < count; ++i) {
-            _mm_store_ps((cixel_f32*)(p + 0), zero);
-            _mm_store_ps((cixel_f32*)(p + 1), zero);
-            _mm_store_ps((cixel_f32*)(p + 2), zero);
-            _mm_store_ps((cixel_f32*)(p + 3), zero);
-            p += 4;
-        }
-        for(cixel_u32 i = 0; i < remain; ++i, ++p) {
-            _mm_store_ps((cixel_f32*)p, zero);
-        }
-    }
-
-    template<cixel_u32 SIZE>
-    void setMinusOne16(void* CIXEL_RESTRICT ptr)
-    {
-        constexpr cixel_u32 total = (SIZE >> 4);
-        constexpr cixel_u32 count = total >> 2;
-        constexpr cixel_u32 remain = total - (count << 2);
-
-        __m128i* p = reinterpret_cast<__m128i*>(ptr);
-        __m128i v = _mm_set1_epi32(-1);
-        for(cixel_u32 i = 0; i < count; ++i) {
-            _mm_store_si128((p + 0), v);
-            _mm_store_si128((p + 1), v);
-            _mm_store_si128((p + 2), v);
-            _mm_store_si128((p + 3), v);
-            p += 4;
-        }
-        for(cixel_u32 i = 0; i < remain; ++i, ++p) {
-            _mm_store_si128(p, v);
-        }
-    }
-
-    void setZero16(void* CIXEL_RESTRICT ptr, cixel_u32 size)
-    {
-        const cixel_u32 total = (size >> 4);
-        const cixel_u32 count = total >> 2;
-        const cixel_u32 remain = total - (count << 2);
-
-        __m128* p = reinterpret_cast<__m128*>(ptr);
-        __m128 zero = _mm_setzero_ps();
-        for(cixel_u32 i = 0; i < count; ++i) {
-            _mm_store_ps((cixel_f32*)(p + 0), zero);
-            _mm_store_ps((cixel_f32*)(p + 1), zero);
-            _mm_store_ps((cixel_f32*)(p + 2), zero);
-            _mm_store_ps((cixel_f32*)(p + 3), zero);
-            p += 4;
-        }
-        for(cixel_u32 i = 0; i < remain; ++i, ++p) {
-            _mm_store_ps((cixel_f32*)p, zero);
-        }
-    }
-#endif
-
 #else //__cplusplus
 
 #define  align(x) ((x + ALIGN_OFFSET) & ALIGN_MASK)
@@ -412,88 +597,32 @@ CIXEL_STATIC inline void subColor32(Color32* c0, const Color32* c1)
         return (x < 256) ? (cixel_u8)(x) : 255;
     }
 
-#if defined(CIXEL_SSE)
-    #define align16(x) ((x+15U)&(~15U))
-
-    CIXEL_STATIC void setZero16(void* CIXEL_RESTRICT ptr, cixel_u32 size)
-    {
-        const cixel_u32 total = (size >> 4);
-        const cixel_u32 count = total >> 2;
-        const cixel_u32 remain = total - (count << 2);
-
-        __m128* p = CIXEL_REINTERPRET_CAST(__m128*)(ptr);
-        __m128 zero = _mm_setzero_ps();
-        for(cixel_u32 i = 0; i < count; ++i) {
-            _mm_store_ps((cixel_f32*)(p + 0), zero);
-            _mm_store_ps((cixel_f32*)(p + 1), zero);
-            _mm_store_ps((cixel_f32*)(p + 2), zero);
-            _mm_store_ps((cixel_f32*)(p + 3), zero);
-            p += 4;
-        }
-        for(cixel_u32 i = 0; i < remain; ++i, ++p) {
-            _mm_store_ps((cixel_f32*)p, zero);
-        }
-    }
-
-    CIXEL_STATIC void setMinusOne16(void* CIXEL_RESTRICT ptr, cixel_u32 size)
-    {
-        const cixel_u32 total = (size >> 4);
-        const cixel_u32 count = total >> 2;
-        const cixel_u32 remain = total - (count << 2);
-
-        __m128i* p = CIXEL_REINTERPRET_CAST(__m128i*)(ptr);
-        __m128i v = _mm_set1_epi32(-1);
-        for(cixel_u32 i = 0; i < count; ++i) {
-            _mm_store_si128((p + 0), v);
-            _mm_store_si128((p + 1), v);
-            _mm_store_si128((p + 2), v);
-            _mm_store_si128((p + 3), v);
-            p += 4;
-        }
-        for(cixel_u32 i = 0; i < remain; ++i, ++p) {
-            _mm_store_si128(p, v);
-        }
-    }
-
-#endif
 #endif
 
     static const cixel_s32 K12YUV655 = 7; // 7.0f / 16.0f;
     static const cixel_s32 K20YUV655 = 3; // 3.0f / 16.0f;
     static const cixel_s32 K21YUV655 = 5; // 5.0f / 16.0f;
     static const cixel_s32 K22YUV655 = 1; // 1.0f / 16.0f;
-#ifdef __cplusplus
-#    if defined(CIXEL_SSE)
-    void muladdDiffustion(ColorS32* c, const __m128i* ratio, const __m128i* error)
-    {
-        __m128i c0 = _mm_load_si128((const __m128i*)c);
-        c0 = _mm_add_epi32(c0, _mm_mul_epi32(*ratio, *error));
-        _mm_store_si128((__m128i*)c, c0);
-    }
-#    else
-    void muladdDiffusion(ColorS32* c, cixel_s32 ratio, const cixel_s32 error[4])
+    // Errors are kept 16 times, and a pixel takes at most 16 * 255 in total, so they fit in 16 bits
+    CIXEL_STATIC inline void muladdDiffusion(ColorS16* c, cixel_s32 ratio, const cixel_s32 error[4])
     {
-        c->r_ += ratio * error[0];
-        c->g_ += ratio * error[1];
-        c->b_ += ratio * error[2];
+        c->r_ = CIXEL_STATIC_CAST(cixel_s16)(c->r_ + ratio * error[0]);
+        c->g_ = CIXEL_STATIC_CAST(cixel_s16)(c->g_ + ratio * error[1]);
+        c->b_ = CIXEL_STATIC_CAST(cixel_s16)(c->b_ + ratio * error[2]);
     }
-#    endif
-#else
-#    if defined(CIXEL_SSE)
-    void muladdDiffustion(ColorS32* c, const __m128i* ratio, const __m128i* error)
+
+#if defined(CIXEL_X86)
+    CIXEL_TARGET_SSE41 CIXEL_STATIC inline __m128i loadErrorSSE41(const ColorS16* c)
     {
-        __m128i c0 = _mm_load_si128((const __m128i*)c);
-        c0 = _mm_add_epi32(c0, _mm_mul_epi32(*ratio, *error));
-        _mm_store_si128((__m128i*)c, c0);
+        return _mm_cvtepi16_epi32(_mm_loadl_epi64((const __m128i*)c));
     }
-#    else
-    void muladdDiffusion(ColorS32* c, cixel_s32 ratio, const cixel_s32 error[4])
+
+    CIXEL_TARGET_SSE41 CIXEL_STATIC inline void muladdDiffusionSSE41(ColorS16* c, __m128i ratio, __m128i error)
     {
-        c->r_ += ratio * error[0];
-        c->g_ += ratio * error[1];
-        c->b_ += ratio * error[2];
+        __m128i c0 = loadErrorSSE41(c);
+        c0 = _mm_add_epi32(c0, _mm_mullo_epi32(ratio, error));
+        _mm_storel_epi64((__m128i*)c, _mm_packs_epi32(c0, c0));
     }
-#    endif
 #endif
 
     static const char header[] = {
@@ -518,6 +647,10 @@ CIXEL_STATIC inline void subColor32(Color32* c0, const Color32* c1)
         0x5CU, //
     };
 
+    static const char digitPairs[] = // "00" to "99"
+        "0001020304050607080910111213141516171819202122232425262728293031323334353637383940414243444546474849"
+        "5051525354555657585960616263646566676869707172737475767778798081828384858687888990919293949596979899";
+
 #ifdef __cplusplus
     static const cixel_s32 RESOLUTION_Y = 32; //128;
     static const cixel_s32 RESOLUTION_U = 32;
@@ -535,6 +668,22 @@ CIXEL_STATIC inline void subColor32(Color32* c0, const Color32* c1)
     static const cixel_s32 GRID_SHIFT_Y = (8 - SHIFT_U) + (8 - SHIFT_V);
     static const cixel_s32 GRID_SHIFT_U = (8 - SHIFT_V);
 
+    static const cixel_s32 GRID_BLOCK = 8; //< cells along each axis of the smallest block, whose cells share candidates of the nearest colors
+
+    static const cixel_s32 SPARSE_LIMIT = 64 * 64; //< images up to this number of pixels are quantized without summed-area tables
+    static const cixel_s32 SPARSE_DENSITY = 12; //< a cell costs about this many cells of summed-area tables
+
+    static const cixel_s32 COLOR_TABLE_SHIFT = 7; //< log2 of number of groups
+    static const cixel_s32 COLOR_TABLE_SIZE = 4 << COLOR_TABLE_SHIFT;
+    static const cixel_u32 COLOR_EMPTY = 0xFFFFFFFFU;
+
+    static const cixel_s32 WAVEFRONT_CHUNK = 64; //< number of pixels diffused between publishing progress
+    static const cixel_s32 STRIP_HEIGHT = 128;
+    static const cixel_s32 STRIP_OVERLAP = 8; //< rows above a strip diffused only to carry errors into it
+
+    static const cixel_s32 WRITE_BUFFER_SIZE = 64 * 1024; //< minimum size of the buffer of sixels, which is written out whenever it is full
+    static const cixel_s32 PASS_RESERVE = 8; //< bytes of a pass of a color besides sixels, for '$', an index, '-' and a footer
+
 #else
 #    define RESOLUTION_Y (32)
 #    define RESOLUTION_U (32)
@@ -551,9 +700,25 @@ CIXEL_STATIC inline void subColor32(Color32* c0, const Color32* c1)
 #    define GRID_V_SIZE RESOLUTION_V
 #    define GRID_SHIFT_Y ((8 - SHIFT_U) + (8 - SHIFT_V))
 #    define GRID_SHIFT_U (8 - SHIFT_V)
+
+#    define GRID_BLOCK (8)
+
+#    define SPARSE_LIMIT (64 * 64)
+#    define SPARSE_DENSITY (12)
+
+#    define COLOR_TABLE_SHIFT (7)
+#    define COLOR_TABLE_SIZE (4 << COLOR_TABLE_SHIFT)
+#    define COLOR_EMPTY (0xFFFFFFFFU)
+
+#    define WAVEFRONT_CHUNK (64)
+#    define STRIP_HEIGHT (128)
+#    define STRIP_OVERLAP (8)
+
+#    define WRITE_BUFFER_SIZE (64 * 1024)
+#    define PASS_RESERVE (8)
 #endif
 
-    CIXEL_STATIC void YUV2RGBPercent(cixel_s32 rgba[4], cixel_u32 yuva)
+    CIXEL_STATIC cixel_u32 YUV2RGBFixed(cixel_u32 yuva)
     {
 #ifdef __cplusplus
         static const cixel_s32 Base = (1 << 10);
@@ -586,12 +751,20 @@ CIXEL_STATIC inline void subColor32(Color32* c0, const Color32* c1)
 
         cixel_s32 su = CIXEL_STATIC_CAST(cixel_s32)(u) - 128;
         cixel_s32 sv = CIXEL_STATIC_CAST(cixel_s32)(v) - 128;
-        rgba[0] = (s00 * y + s02 * sv + Half) >> 10;
-        rgba[1] = (s10 * y + s11 * su + s12 * sv + Half) >> 10;
-        rgba[2] = (s20 * y + s21 * su + Half) >> 10;
-        rgba[0] = clamp(rgba[0], 0, 255);
-        rgba[1] = clamp(rgba[1], 0, 255);
-        rgba[2] = clamp(rgba[2], 0, 255);
+        cixel_s32 r = (s00 * y + s02 * sv + Half) >> 10;
+        cixel_s32 g = (s10 * y + s11 * su + s12 * sv + Half) >> 10;
+        cixel_s32 b = (s20 * y + s21 * su + Half) >> 10;
+        r = clamp(r, 0, 255);
+        g = clamp(g, 0, 255);
+        b = clamp(b, 0, 255);
+        return CIXEL_STATIC_CAST(cixel_u32)(r) | (CIXEL_STATIC_CAST(cixel_u32)(g) << 8) | (CIXEL_STATIC_CAST(cixel_u32)(b) << 16) | (yuva & 0xFF000000U);
+    }
+
+    CIXEL_STATIC void RGB2Percent(cixel_s32 rgba[4], cixel_u32 rgb)
+    {
+        rgba[0] = CIXEL_STATIC_CAST(cixel_s32)(rgb & 0xFFU);
+        rgba[1] = CIXEL_STATIC_CAST(cixel_s32)((rgb >> 8) & 0xFFU);
+        rgba[2] = CIXEL_STATIC_CAST(cixel_s32)((rgb >> 16) & 0xFFU);
 
         rgba[0] *= 100 * (1 << (10 - 8));
         rgba[1] *= 100 * (1 << (10 - 8));
@@ -605,81 +778,57 @@ CIXEL_STATIC inline void subColor32(Color32* c0, const Color32* c1)
         CIXEL_ASSERT(0 <= rgba[2] && rgba[2] <= 100);
     }
 
-CIXEL_NAMESPACE_EMPTY_END
-
-cixel_u32 cixelRGB2YUV(cixel_u32 rgba)
-{
-#if defined(CIXEL_SSE)
-    static CIXEL_ALIGN(16) const cixel_f32 sr[4] = {0.299f, -0.169f, 0.500f, 1.0f};
-    static CIXEL_ALIGN(16) const cixel_f32 sg[4] = {0.587f, -0.331f, -0.419f, 0.0f};
-    static CIXEL_ALIGN(16) const cixel_f32 sb[4] = {0.114f, 0.500f, -0.081f, 0.0f};
-    static CIXEL_ALIGN(16) const cixel_f32 so[4] = {0.0f, 128.0f, 128.0f, 0.0f};
-
-    __m128i zero = _mm_setzero_si128();
-    __m128i i0 = _mm_cvtsi32_si128(*((cixel_s32*)&rgba));
-    i0 = _mm_unpacklo_epi8(i0, zero);
-    i0 = _mm_unpacklo_epi16(i0, zero);
-
-    __m128 f0 = _mm_cvtepi32_ps(i0);
-    __m128 fr0 = _mm_shuffle_ps(f0, f0, _MM_SHUFFLE(3, 0, 0, 0));
-    __m128 fg0 = _mm_shuffle_ps(f0, f0, _MM_SHUFFLE(3, 1, 1, 1));
-    __m128 fb0 = _mm_shuffle_ps(f0, f0, _MM_SHUFFLE(3, 2, 2, 2));
-
-    fr0 = _mm_mul_ps(fr0, _mm_load_ps(sr));
-    fg0 = _mm_mul_ps(fg0, _mm_load_ps(sg));
-    fb0 = _mm_mul_ps(fb0, _mm_load_ps(sb));
-    f0 = _mm_add_ps(_mm_add_ps(fr0, fg0), _mm_add_ps(fb0, _mm_load_ps(so)));
-
-    i0 = _mm_cvttps_epi32(f0);
-    i0 = _mm_packs_epi32(i0, i0);
-    i0 = _mm_packus_epi16(i0, i0);
-
-    *((cixel_s32*)&rgba) = _mm_cvtsi128_si32(i0);
-    return rgba;
-#else
+    CIXEL_STATIC cixel_u32 RGB2YUVFixed(cixel_u32 rgba)
+    {
 #    ifdef __cplusplus
-    static const cixel_s32 Base = 1 << 10;
-    static const cixel_s32 Half = Base >> 1;
-    static const cixel_s32 s00 = CIXEL_STATIC_CAST(cixel_s32)(0.299f * Base);
-    static const cixel_s32 s01 = CIXEL_STATIC_CAST(cixel_s32)(0.587f * Base);
-    static const cixel_s32 s02 = CIXEL_STATIC_CAST(cixel_s32)(0.114f * Base);
-
-    static const cixel_s32 s10 = CIXEL_STATIC_CAST(cixel_s32)(-0.169f * Base);
-    static const cixel_s32 s11 = CIXEL_STATIC_CAST(cixel_s32)(-0.331f * Base);
-    static const cixel_s32 s12 = CIXEL_STATIC_CAST(cixel_s32)(0.500f * Base);
-
-    static const cixel_s32 s20 = CIXEL_STATIC_CAST(cixel_s32)(0.500f * Base);
-    static const cixel_s32 s21 = CIXEL_STATIC_CAST(cixel_s32)(-0.419f * Base);
-    static const cixel_s32 s22 = CIXEL_STATIC_CAST(cixel_s32)(-0.081f * Base);
+        static const cixel_s32 Base = 1 << 10;
+        static const cixel_s32 Half = Base >> 1;
+        static const cixel_s32 s00 = CIXEL_STATIC_CAST(cixel_s32)(0.299f * Base);
+        static const cixel_s32 s01 = CIXEL_STATIC_CAST(cixel_s32)(0.587f * Base);
+        static const cixel_s32 s02 = CIXEL_STATIC_CAST(cixel_s32)(0.114f * Base);
+
+        static const cixel_s32 s10 = CIXEL_STATIC_CAST(cixel_s32)(-0.169f * Base);
+        static const cixel_s32 s11 = CIXEL_STATIC_CAST(cixel_s32)(-0.331f * Base);
+        static const cixel_s32 s12 = CIXEL_STATIC_CAST(cixel_s32)(0.500f * Base);
+
+        static const cixel_s32 s20 = CIXEL_STATIC_CAST(cixel_s32)(0.500f * Base);
+        static const cixel_s32 s21 = CIXEL_STATIC_CAST(cixel_s32)(-0.419f * Base);
+        static const cixel_s32 s22 = CIXEL_STATIC_CAST(cixel_s32)(-0.081f * Base);
 #    else
 
-    static const cixel_s32 Half = 512;
-    static const cixel_s32 s00 = CIXEL_STATIC_CAST(cixel_s32)(0.299f * 1024);
-    static const cixel_s32 s01 = CIXEL_STATIC_CAST(cixel_s32)(0.587f * 1024);
-    static const cixel_s32 s02 = CIXEL_STATIC_CAST(cixel_s32)(0.114f * 1024);
+        static const cixel_s32 Half = 512;
+        static const cixel_s32 s00 = CIXEL_STATIC_CAST(cixel_s32)(0.299f * 1024);
+        static const cixel_s32 s01 = CIXEL_STATIC_CAST(cixel_s32)(0.587f * 1024);
+        static const cixel_s32 s02 = CIXEL_STATIC_CAST(cixel_s32)(0.114f * 1024);
 
-    static const cixel_s32 s10 = CIXEL_STATIC_CAST(cixel_s32)(-0.169f * 1024);
-    static const cixel_s32 s11 = CIXEL_STATIC_CAST(cixel_s32)(-0.331f * 1024);
-    static const cixel_s32 s12 = CIXEL_STATIC_CAST(cixel_s32)(0.500f * 1024);
+        static const cixel_s32 s10 = CIXEL_STATIC_CAST(cixel_s32)(-0.169f * 1024);
+        static const cixel_s32 s11 = CIXEL_STATIC_CAST(cixel_s32)(-0.331f * 1024);
+        static const cixel_s32 s12 = CIXEL_STATIC_CAST(cixel_s32)(0.500f * 1024);
 
-    static const cixel_s32 s20 = CIXEL_STATIC_CAST(cixel_s32)(0.500f * 1024);
-    static const cixel_s32 s21 = CIXEL_STATIC_CAST(cixel_s32)(-0.419f * 1024);
-    static const cixel_s32 s22 = CIXEL_STATIC_CAST(cixel_s32)(-0.081f * 1024);
+        static const cixel_s32 s20 = CIXEL_STATIC_CAST(cixel_s32)(0.500f * 1024);
+        static const cixel_s32 s21 = CIXEL_STATIC_CAST(cixel_s32)(-0.419f * 1024);
+        static const cixel_s32 s22 = CIXEL_STATIC_CAST(cixel_s32)(-0.081f * 1024);
 #    endif
 
-    cixel_u8 r = CIXEL_STATIC_CAST(cixel_u8)(rgba);
-    cixel_u8 g = CIXEL_STATIC_CAST(cixel_u8)(rgba >> 8);
-    cixel_u8 b = CIXEL_STATIC_CAST(cixel_u8)(rgba >> 16);
-    cixel_s32 y = (s00 * r + s01 * g + s02 * b + Half) >> 10;
-    cixel_s32 u = ((s10 * r + s11 * g + s12 * b + Half) >> 10) + 128;
-    cixel_s32 v = ((s20 * r + s21 * g + s22 * b + Half) >> 10) + 128;
-
-    rgba &= 0xFF000000U;
-    rgba |= minimum(y, 255);
-    rgba |= minimum(u, 255) << 8;
-    rgba |= minimum(v, 255) << 16;
-    return rgba;
-#endif
+        cixel_u8 r = CIXEL_STATIC_CAST(cixel_u8)(rgba);
+        cixel_u8 g = CIXEL_STATIC_CAST(cixel_u8)(rgba >> 8);
+        cixel_u8 b = CIXEL_STATIC_CAST(cixel_u8)(rgba >> 16);
+        cixel_s32 y = (s00 * r + s01 * g + s02 * b + Half) >> 10;
+        cixel_s32 u = ((s10 * r + s11 * g + s12 * b + Half) >> 10) + 128;
+        cixel_s32 v = ((s20 * r + s21 * g + s22 * b + Half) >> 10) + 128;
+
+        rgba &= 0xFF000000U;
+        rgba |= minimum(y, 255);
+        rgba |= minimum(u, 255) << 8;
+        rgba |= minimum(v, 255) << 16;
+        return rgba;
+    }
+
+CIXEL_NAMESPACE_EMPTY_END
+
+cixel_u32 cixelRGB2YUV(cixel_u32 rgba)
+{
+    return RGB2YUVFixed(rgba);
 }
 
 cixel_u32 cixelYUV2RGB(cixel_u32 yuva)
@@ -760,6 +909,172 @@ cixel_u32 cixelYUV2RGB(cixel_u32 yuva)
 #endif
 }
 
+CIXEL_NAMESPACE_EMPTY_BEGIN
+    enum SIMD_t
+    {
+        SIMD_Scalar = 0,
+        SIMD_SSE41,
+        SIMD_AVX2,
+    };
+
+    typedef enum SIMD_t SIMD;
+
+    CIXEL_STATIC SIMD detectSIMD()
+    {
+#if defined(CIXEL_X86)
+#    if defined(_MSC_VER) && !defined(__clang__)
+        int info[4];
+        __cpuid(info, 0);
+        int maxId = info[0];
+        __cpuid(info, 1);
+        bool sse41 = 0 != (info[2] & (1 << 19));
+        bool osxsave = 0 != (info[2] & (1 << 27));
+        bool avx = 0 != (info[2] & (1 << 28));
+        bool avx2 = false;
+        if(7 <= maxId && osxsave && avx && 6 == (_xgetbv(0) & 6)) {
+            __cpuidex(info, 7, 0);
+            avx2 = 0 != (info[1] & (1 << 5));
+        }
+#    else
+        __builtin_cpu_init();
+        bool sse41 = 0 != __builtin_cpu_supports("sse4.1");
+        bool avx2 = 0 != __builtin_cpu_supports("avx2");
+#    endif
+        if(avx2) {
+            return SIMD_AVX2;
+        }
+        if(sse41) {
+            return SIMD_SSE41;
+        }
+#endif
+        return SIMD_Scalar;
+    }
+
+    CIXEL_STATIC SIMD getSIMD()
+    {
+        // Contexts created at once on threads may detect twice, which stores the same result
+        static cixel_s32 simd = -1;
+        cixel_s32 detected = CIXEL_ATOMIC_LOAD(&simd);
+        if(detected < 0) {
+            detected = CIXEL_STATIC_CAST(cixel_s32)(detectSIMD());
+            CIXEL_ATOMIC_STORE(&simd, detected);
+        }
+        return CIXEL_STATIC_CAST(SIMD)(detected);
+    }
+
+    CIXEL_STATIC void rgb2yuvRowScalar(cixel_u32* CIXEL_RESTRICT yuva, const cixel_u32* CIXEL_RESTRICT rgba, cixel_s32 count)
+    {
+        for(cixel_s32 i = 0; i < count; ++i) {
+            yuva[i] = RGB2YUVFixed(rgba[i]);
+        }
+    }
+
+#if defined(CIXEL_X86)
+    CIXEL_STATIC cixel_s32 packS16(cixel_s32 low, cixel_s32 high)
+    {
+        return CIXEL_STATIC_CAST(cixel_s32)((CIXEL_STATIC_CAST(cixel_u32)(high) << 16) | (CIXEL_STATIC_CAST(cixel_u32)(low) & 0xFFFFU));
+    }
+
+    // Pair (r, b) and (g, a) in 16 bit lanes, then madd them with the coefficients of RGB2YUVFixed
+    CIXEL_TARGET_SSE41 CIXEL_STATIC void rgb2yuvRowSSE41(cixel_u32* CIXEL_RESTRICT yuva, const cixel_u32* CIXEL_RESTRICT rgba, cixel_s32 count)
+    {
+        const __m128i maskRB = _mm_set1_epi32(0x00FF00FF);
+        const __m128i maskA = _mm_set1_epi32(CIXEL_STATIC_CAST(cixel_s32)(0xFF000000U));
+        const __m128i half = _mm_set1_epi32(512);
+        const __m128i offset = _mm_set1_epi32(128);
+        const __m128i zero = _mm_setzero_si128();
+        const __m128i c255 = _mm_set1_epi32(255);
+
+        const __m128i yRB = _mm_set1_epi32(packS16(CIXEL_STATIC_CAST(cixel_s32)(0.299f * 1024), CIXEL_STATIC_CAST(cixel_s32)(0.114f * 1024)));
+        const __m128i yGA = _mm_set1_epi32(packS16(CIXEL_STATIC_CAST(cixel_s32)(0.587f * 1024), 0));
+        const __m128i uRB = _mm_set1_epi32(packS16(CIXEL_STATIC_CAST(cixel_s32)(-0.169f * 1024), CIXEL_STATIC_CAST(cixel_s32)(0.500f * 1024)));
+        const __m128i uGA = _mm_set1_epi32(packS16(CIXEL_STATIC_CAST(cixel_s32)(-0.331f * 1024), 0));
+        const __m128i vRB = _mm_set1_epi32(packS16(CIXEL_STATIC_CAST(cixel_s32)(0.500f * 1024), CIXEL_STATIC_CAST(cixel_s32)(-0.081f * 1024)));
+        const __m128i vGA = _mm_set1_epi32(packS16(CIXEL_STATIC_CAST(cixel_s32)(-0.419f * 1024), 0));
+
+        cixel_s32 i = 0;
+        for(; (i + 4) <= count; i += 4) {
+            __m128i p = _mm_loadu_si128(CIXEL_REINTERPRET_CAST(const __m128i*)(rgba + i));
+            __m128i rb = _mm_and_si128(p, maskRB);
+            __m128i ga = _mm_and_si128(_mm_srli_epi32(p, 8), maskRB);
+
+            __m128i y = _mm_add_epi32(_mm_madd_epi16(rb, yRB), _mm_madd_epi16(ga, yGA));
+            __m128i u = _mm_add_epi32(_mm_madd_epi16(rb, uRB), _mm_madd_epi16(ga, uGA));
+            __m128i v = _mm_add_epi32(_mm_madd_epi16(rb, vRB), _mm_madd_epi16(ga, vGA));
+            y = _mm_srai_epi32(_mm_add_epi32(y, half), 10);
+            u = _mm_add_epi32(_mm_srai_epi32(_mm_add_epi32(u, half), 10), offset);
+            v = _mm_add_epi32(_mm_srai_epi32(_mm_add_epi32(v, half), 10), offset);
+            y = _mm_min_epi32(_mm_max_epi32(y, zero), c255);
+            u = _mm_min_epi32(_mm_max_epi32(u, zero), c255);
+            v = _mm_min_epi32(_mm_max_epi32(v, zero), c255);
+
+            __m128i result = _mm_or_si128(_mm_and_si128(p, maskA), y);
+            result = _mm_or_si128(result, _mm_slli_epi32(u, 8));
+            result = _mm_or_si128(result, _mm_slli_epi32(v, 16));
+            _mm_storeu_si128(CIXEL_REINTERPRET_CAST(__m128i*)(yuva + i), result);
+        }
+        rgb2yuvRowScalar(yuva + i, rgba + i, count - i);
+    }
+
+    CIXEL_TARGET_AVX2 CIXEL_STATIC void rgb2yuvRowAVX2(cixel_u32* CIXEL_RESTRICT yuva, const cixel_u32* CIXEL_RESTRICT rgba, cixel_s32 count)
+    {
+        const __m256i maskRB = _mm256_set1_epi32(0x00FF00FF);
+        const __m256i maskA = _mm256_set1_epi32(CIXEL_STATIC_CAST(cixel_s32)(0xFF000000U));
+        const __m256i half = _mm256_set1_epi32(512);
+        const __m256i offset = _mm256_set1_epi32(128);
+        const __m256i zero = _mm256_setzero_si256();
+        const __m256i c255 = _mm256_set1_epi32(255);
+
+        const __m256i yRB = _mm256_set1_epi32(packS16(CIXEL_STATIC_CAST(cixel_s32)(0.299f * 1024), CIXEL_STATIC_CAST(cixel_s32)(0.114f * 1024)));
+        const __m256i yGA = _mm256_set1_epi32(packS16(CIXEL_STATIC_CAST(cixel_s32)(0.587f * 1024), 0));
+        const __m256i uRB = _mm256_set1_epi32(packS16(CIXEL_STATIC_CAST(cixel_s32)(-0.169f * 1024), CIXEL_STATIC_CAST(cixel_s32)(0.500f * 1024)));
+        const __m256i uGA = _mm256_set1_epi32(packS16(CIXEL_STATIC_CAST(cixel_s32)(-0.331f * 1024), 0));
+        const __m256i vRB = _mm256_set1_epi32(packS16(CIXEL_STATIC_CAST(cixel_s32)(0.500f * 1024), CIXEL_STATIC_CAST(cixel_s32)(-0.081f * 1024)));
+        const __m256i vGA = _mm256_set1_epi32(packS16(CIXEL_STATIC_CAST(cixel_s32)(-0.419f * 1024), 0));
+
+        cixel_s32 i = 0;
+        for(; (i + 8) <= count; i += 8) {
+            __m256i p = _mm256_loadu_si256(CIXEL_REINTERPRET_CAST(const __m256i*)(rgba + i));
+            __m256i rb = _mm256_and_si256(p, maskRB);
+            __m256i ga = _mm256_and_si256(_mm256_srli_epi32(p, 8), maskRB);
+
+            __m256i y = _mm256_add_epi32(_mm256_madd_epi16(rb, yRB), _mm256_madd_epi16(ga, yGA));
+            __m256i u = _mm256_add_epi32(_mm256_madd_epi16(rb, uRB), _mm256_madd_epi16(ga, uGA));
+            __m256i v = _mm256_add_epi32(_mm256_madd_epi16(rb, vRB), _mm256_madd_epi16(ga, vGA));
+            y = _mm256_srai_epi32(_mm256_add_epi32(y, half), 10);
+            u = _mm256_add_epi32(_mm256_srai_epi32(_mm256_add_epi32(u, half), 10), offset);
+            v = _mm256_add_epi32(_mm256_srai_epi32(_mm256_add_epi32(v, half), 10), offset);
+            y = _mm256_min_epi32(_mm256_max_epi32(y, zero), c255);
+            u = _mm256_min_epi32(_mm256_max_epi32(u, zero), c255);
+            v = _mm256_min_epi32(_mm256_max_epi32(v, zero), c255);
+
+            __m256i result = _mm256_or_si256(_mm256_and_si256(p, maskA), y);
+            result = _mm256_or_si256(result, _mm256_slli_epi32(u, 8));
+            result = _mm256_or_si256(result, _mm256_slli_epi32(v, 16));
+            _mm256_storeu_si256(CIXEL_REINTERPRET_CAST(__m256i*)(yuva + i), result);
+        }
+        rgb2yuvRowScalar(yuva + i, rgba + i, count - i);
+    }
+#endif
+CIXEL_NAMESPACE_EMPTY_END
+
+void cixelRGB2YUVRow(cixel_u32* CIXEL_RESTRICT yuva, const cixel_u32* CIXEL_RESTRICT rgba, cixel_s32 count)
+{
+#if defined(CIXEL_X86)
+    switch(getSIMD()) {
+    case SIMD_AVX2:
+        rgb2yuvRowAVX2(yuva, rgba, count);
+        return;
+    case SIMD_SSE41:
+        rgb2yuvRowSSE41(yuva, rgba, count);
+        return;
+    default:
+        break;
+    }
+#endif
+    rgb2yuvRowScalar(yuva, rgba, count);
+}
+
 //-----------------------------------------------------------
 //---
 //--- Cixel
@@ -769,34 +1084,204 @@ struct Bucket_t
 {
     BoxU8 box_;
     cixel_u32 frequency_;
+    cixel_u32 priority_;
+    cixel_s32 cellStart_; //< range of cells in the box, only for sparse quantization
+    cixel_s32 cellEnd_;
 };
 
 typedef struct Bucket_t Bucket;
 
-struct Cixel_t
+/**
+@brief An occupied cell of the histogram, for sparse quantization
+*/
+struct Cell_t
 {
-    AllocFunc allocFunc_;
-    FreeFunc freeFunc_;
+    PointU8 point_;
+    cixel_u32 frequency_;
+    Color32 accColor_;
+};
 
-    cixel_s32 width_;
-    cixel_s32 height_;
+typedef struct Cell_t Cell;
+
+/**
+@brief Histograms of the cells of a bucket projected on each axis, for sparse quantization
+*/
+struct Projection_t
+{
+    cixel_u32 frequencies_[3][RESOLUTION_Y];
+    Color32 accColors_[3][RESOLUTION_Y];
+};
+
+typedef struct Projection_t Projection;
+
+/**
+@brief Open addressing hash table from a RGB color to its index, probed by groups of four slots
+*/
+struct ColorTable_t
+{
+    cixel_u32 keys_[COLOR_TABLE_SIZE];
+    cixel_u8 values_[COLOR_TABLE_SIZE];
+    cixel_u32 colors_[MAX_COLORS];
+    cixel_s32 size_;
+    cixel_s32 capacity_;
+};
+
+typedef struct ColorTable_t ColorTable;
+
+struct Histogram_t
+{
+    cixel_u32* frequencies_;
+    Color32* accColors_;
+    BoxU8 box_;
+};
+
+typedef struct Histogram_t Histogram;
+
+/**
+@brief Private rows of a job which diffuses strips
+*/
+struct Strip_t
+{
+    ColorS16* errors_; //< errors of the current and the next rows
+    cixel_u8* indices_; //< indices of a row which overlaps the strip above
+};
+
+typedef struct Strip_t Strip;
+
+/**
+@brief Destination of sixels, either a callback or a buffer of the caller
+*/
+struct Writer_t
+{
+    cixel_u8* buffer_; //< where sixels are written now, the internal buffer or the rest of the destination
+    cixel_s32 capacity_;
+    cixel_u8* staging_; //< the internal buffer
+    cixel_s32 stagingSize_;
+    WriteFunc writeFunc_; //< CIXEL_NULL for a destination in memory
+    void* userData_;
+    cixel_u8* destination_;
+    cixel_size_t destinationSize_;
+    cixel_size_t total_; //< number of bytes written out
+};
+
+typedef struct Writer_t Writer;
+
+/**
+@brief Scratch to encode a band of six rows
+*/
+struct Band_t
+{
+    cixel_u8* sixels_; //< six bits of a color at each column
+    cixel_u32* colorFlags_; //< colors in a band
+    cixel_s32* starts_; //< the first column of each color in each row, then in a band
+    cixel_s32* ends_; //< the last column plus one of each color in each row, then in a band
+    cixel_u8* buffer_; //< sixels of a band encoded in parallel
+    cixel_s32 size_; //< number of bytes in buffer_
+};
+
+typedef struct Band_t Band;
+
+/**
+@brief Colors which can be the nearest to cells of a block of the grid, laid out by axis
+*/
+struct Candidates_t
+{
+    CIXEL_ALIGN(32) cixel_s32 y_[MAX_COLORS];
+    CIXEL_ALIGN(32) cixel_s32 u_[MAX_COLORS];
+    CIXEL_ALIGN(32) cixel_s32 v_[MAX_COLORS];
+    CIXEL_ALIGN(32) cixel_s32 indices_[MAX_COLORS];
+    cixel_s32 size_; //< padded to a multiple of eight with copies of the first one
+};
+
+typedef struct Candidates_t Candidates;
+
+/**
+@brief Hot loops, selected at cixelCreate for the running CPU
+*/
+struct Kernels_t
+{
+    void (*rgb2yuvRow_)(cixel_u32* CIXEL_RESTRICT yuva, const cixel_u32* CIXEL_RESTRICT rgba, cixel_s32 count);
+    void (*accumulateRow_)(Histogram* histogram, const Color* CIXEL_RESTRICT yuv, cixel_s32 width);
+    void (*diffuseRight_)(const Cixel* cixel, cixel_u8* CIXEL_RESTRICT indices, const Color* CIXEL_RESTRICT yuv, ColorS16* CIXEL_RESTRICT current, ColorS16* CIXEL_RESTRICT next, cixel_s32 start, cixel_s32 end);
+    void (*diffuseLeft_)(const Cixel* cixel, cixel_u8* CIXEL_RESTRICT indices, const Color* CIXEL_RESTRICT yuv, ColorS16* CIXEL_RESTRICT current, ColorS16* CIXEL_RESTRICT next, cixel_s32 start, cixel_s32 end);
+    cixel_s32 (*findRunEnd_)(const cixel_u8* CIXEL_RESTRICT bits, cixel_s32 start, cixel_s32 end);
+    void (*buildSixels_)(cixel_u8* CIXEL_RESTRICT sixels, const cixel_u8* CIXEL_RESTRICT indices, cixel_s32 width, cixel_s32 rows, cixel_u8 color, cixel_s32 start, cixel_s32 end);
+    void (*addRow_)(cixel_u32* CIXEL_RESTRICT dst, const cixel_u32* CIXEL_RESTRICT src, cixel_s32 count);
+    bool (*mapColorRow_)(ColorTable* table, cixel_u8* CIXEL_RESTRICT indices, const cixel_u32* CIXEL_RESTRICT pixels, cixel_s32 count);
+    cixel_s32 (*findNearest_)(const Candidates* candidates, cixel_s32 y, cixel_s32 u, cixel_s32 v);
+};
+
+typedef struct Kernels_t Kernels;
+
+struct CixelEncoder_t
+{
+    AllocFunc allocFunc_;
+    FreeFunc freeFunc_;
+    void* workspace_; //< memory allocated by cixelEncoderCreate, CIXEL_NULL for memory of the caller
+
+    cixel_s32 width_;
+    cixel_s32 height_;
+    Kernels kernels_;
+
+    cixel_u8* writeBuffer_;
+    cixel_s32 writeBufferSize_;
+    Band band_;
+
+    cixel_s32 numThreads_;
+    ParallelFunc parallelFunc_;
+    void* parallelUserData_;
+    void* parallelWork_;
+    Band* bands_; //< private scratch for threads except the first one
+};
+
+struct Cixel_t
+{
+    AllocFunc allocFunc_;
+    FreeFunc freeFunc_;
+    void* workspace_; //< memory allocated by cixelCreate, CIXEL_NULL for memory of the caller
+    cixel_size_t capacity_; //< bytes of the workspace from the context
+    cixel_u32 options_;
+
+    cixel_s32 width_;
+    cixel_s32 height_;
     cixel_s32 size_;
+    cixel_s32 maxColors_;
+    Dither dither_;
+    Kernels kernels_;
 
     Color* colors_;
+    Color* pallet_; //< RGB of colors_
     cixel_s16* grid_;
+    BoxU8 dirty_; //< cells of the tables touched by the last quantization
+    BoxU8 gridBox_; //< cells of the grid which boxes of the last quantization can cover, fillGrid overwrites the others
 
     Color* yuv_;
 
     cixel_u32* frequencies_;
     Color32* accColors_;
     Bucket* boxes_;
-
-    ColorS32* errors_;
-
-    cixel_u8* writeBuffer_;
-    cixel_u8* indicesFlags_;
-    cixel_u32* colorFlags_;
-    cixel_u8* palletIndices_;
+    Cell* cells_;
+    ColorTable* colorTable_;
+    cixel_s32 sparseLimit_;
+    bool sparse_; //< the last quantization used cells instead of summed-area tables
+
+    ColorS16* errors_; //< two rows of errors, which roll down the image
+    Strip strip_;
+
+    CixelEncoder encoder_; //< buffers apart from the quantization, which are not clobbered by each other
+
+    PriorityFunc priorityFunc_;
+
+    cixel_s32 numThreads_;
+    ParallelFunc parallelFunc_;
+    void* parallelUserData_;
+    void* parallelWork_;
+    cixel_s32 parallelWidth_; //< size of image which work of threads was allocated for
+    cixel_s32 parallelHeight_;
+    Histogram* histograms_; //< private histograms for threads except the first one
+    Strip* strips_; //< private rows for threads except the first one
+    ColorS16* ring_; //< rows of errors for the wavefront, one more than threads
+    cixel_s32* progress_; //< number of diffused pixels of each row for the wavefront
 };
 
 CIXEL_NAMESPACE_EMPTY_BEGIN
@@ -805,119 +1290,444 @@ CIXEL_NAMESPACE_EMPTY_BEGIN
     //--- Cixel functions
     //---
     //-----------------------------------------------------------
-    CIXEL_STATIC void getAccumulations(Cixel* cixel, Bucket* buckets, const cixel_u32* CIXEL_RESTRICT pixels)
+    CIXEL_STATIC inline void accumulatePixel(Histogram* histogram, Color yuv)
     {
-        cixel_s32 size = cixel->width_ * cixel->height_;
-        for(cixel_s32 i = 0; i < size; ++i) {
-            BoxU8* box = &buckets[0].box_;
-            cixel->yuv_[i].color_ = cixelRGB2YUV(pixels[i]);
+        BoxU8* box = &histogram->box_;
+        cixel_s32 qr = yuv.rgba_.r_ >> SHIFT_Y;
+        cixel_s32 qg = yuv.rgba_.g_ >> SHIFT_U;
+        cixel_s32 qb = yuv.rgba_.b_ >> SHIFT_V;
+        cixel_s32 index = (qr + 1) * UV_PLANE_SIZE + (qg + 1) * V_SIZE + qb + 1;
+        histogram->frequencies_[index] += 1;
+
+        histogram->accColors_[index].r_ += yuv.rgba_.r_;
+        histogram->accColors_[index].g_ += yuv.rgba_.g_;
+        histogram->accColors_[index].b_ += yuv.rgba_.b_;
+
+        cixel_u8 r8 = CIXEL_STATIC_CAST(cixel_u8)(qr);
+        cixel_u8 g8 = CIXEL_STATIC_CAST(cixel_u8)(qg);
+        cixel_u8 b8 = CIXEL_STATIC_CAST(cixel_u8)(qb);
+
+        box->start_.x_ = minimum(box->start_.x_, r8);
+        box->start_.y_ = minimum(box->start_.y_, g8);
+        box->start_.z_ = minimum(box->start_.z_, b8);
+
+        box->end_.x_ = maximum(box->end_.x_, r8);
+        box->end_.y_ = maximum(box->end_.y_, g8);
+        box->end_.z_ = maximum(box->end_.z_, b8);
+    }
 
-            cixel_s32 qr = cixel->yuv_[i].rgba_.r_ >> SHIFT_Y;
-            cixel_s32 qg = cixel->yuv_[i].rgba_.g_ >> SHIFT_U;
-            cixel_s32 qb = cixel->yuv_[i].rgba_.b_ >> SHIFT_V;
-            cixel_s32 index = (qr + 1) * UV_PLANE_SIZE + (qg + 1) * V_SIZE + qb + 1;
-            cixel->frequencies_[index] += 1;
+    CIXEL_STATIC void accumulateRowScalar(Histogram* histogram, const Color* CIXEL_RESTRICT yuv, cixel_s32 width)
+    {
+        for(cixel_s32 j = 0; j < width; ++j) {
+            accumulatePixel(histogram, yuv[j]);
+        }
+    }
 
-            cixel->accColors_[index].r_ += cixel->yuv_[i].rgba_.r_;
-            cixel->accColors_[index].g_ += cixel->yuv_[i].rgba_.g_;
-            cixel->accColors_[index].b_ += cixel->yuv_[i].rgba_.b_;
+#if defined(CIXEL_X86)
+    /**
+    @brief Merge per-byte bounds of yuv values into a box
+    */
+    CIXEL_STATIC void mergeBounds(BoxU8* box, const cixel_u32* minimums, const cixel_u32* maximums, cixel_s32 count)
+    {
+        Color minimum8;
+        Color maximum8;
+        minimum8.color_ = 0xFFFFFFFFU;
+        maximum8.color_ = 0;
+        for(cixel_s32 i = 0; i < count; ++i) {
+            Color c0;
+            Color c1;
+            c0.color_ = minimums[i];
+            c1.color_ = maximums[i];
+            minimum8.rgba_.r_ = minimum(minimum8.rgba_.r_, c0.rgba_.r_);
+            minimum8.rgba_.g_ = minimum(minimum8.rgba_.g_, c0.rgba_.g_);
+            minimum8.rgba_.b_ = minimum(minimum8.rgba_.b_, c0.rgba_.b_);
+            maximum8.rgba_.r_ = maximum(maximum8.rgba_.r_, c1.rgba_.r_);
+            maximum8.rgba_.g_ = maximum(maximum8.rgba_.g_, c1.rgba_.g_);
+            maximum8.rgba_.b_ = maximum(maximum8.rgba_.b_, c1.rgba_.b_);
+        }
+        box->start_.x_ = minimum(box->start_.x_, CIXEL_STATIC_CAST(cixel_u8)(minimum8.rgba_.r_ >> SHIFT_Y));
+        box->start_.y_ = minimum(box->start_.y_, CIXEL_STATIC_CAST(cixel_u8)(minimum8.rgba_.g_ >> SHIFT_U));
+        box->start_.z_ = minimum(box->start_.z_, CIXEL_STATIC_CAST(cixel_u8)(minimum8.rgba_.b_ >> SHIFT_V));
+        box->end_.x_ = maximum(box->end_.x_, CIXEL_STATIC_CAST(cixel_u8)(maximum8.rgba_.r_ >> SHIFT_Y));
+        box->end_.y_ = maximum(box->end_.y_, CIXEL_STATIC_CAST(cixel_u8)(maximum8.rgba_.g_ >> SHIFT_U));
+        box->end_.z_ = maximum(box->end_.z_, CIXEL_STATIC_CAST(cixel_u8)(maximum8.rgba_.b_ >> SHIFT_V));
+    }
 
-            cixel_u8 r8 = CIXEL_STATIC_CAST(cixel_u8)(qr);
-            cixel_u8 g8 = CIXEL_STATIC_CAST(cixel_u8)(qg);
-            cixel_u8 b8 = CIXEL_STATIC_CAST(cixel_u8)(qb);
+    // Cell indices are calculated in vector registers, (y, v) are paired in 16 bit lanes because SHIFT_Y equals SHIFT_V
+    CIXEL_TARGET_SSE41 CIXEL_STATIC void accumulateRowSSE41(Histogram* histogram, const Color* CIXEL_RESTRICT yuv, cixel_s32 width)
+    {
+        CIXEL_ALIGN(16) cixel_s32 indices[4];
+        CIXEL_ALIGN(16) cixel_u32 minimums[4];
+        CIXEL_ALIGN(16) cixel_u32 maximums[4];
+        const __m128i maskYV = _mm_set1_epi32(0x001F001F);
+        const __m128i maskU = _mm_set1_epi32(0x1F);
+        const __m128i scaleYV = _mm_set1_epi32(packS16(UV_PLANE_SIZE, 1));
+        const __m128i scaleU = _mm_set1_epi32(V_SIZE);
+        const __m128i offset = _mm_set1_epi32(UV_PLANE_SIZE + V_SIZE + 1);
+        __m128i minimum8 = _mm_set1_epi32(-1);
+        __m128i maximum8 = _mm_setzero_si128();
+
+        cixel_u32* frequencies = histogram->frequencies_;
+        Color32* accColors = histogram->accColors_;
+        cixel_s32 j = 0;
+        for(; (j + 4) <= width; j += 4) {
+            __m128i p = _mm_loadu_si128(CIXEL_REINTERPRET_CAST(const __m128i*)(yuv + j));
+            minimum8 = _mm_min_epu8(minimum8, p);
+            maximum8 = _mm_max_epu8(maximum8, p);
+            __m128i yv = _mm_and_si128(_mm_srli_epi32(p, SHIFT_Y), maskYV);
+            __m128i u = _mm_and_si128(_mm_srli_epi32(p, 8 + SHIFT_U), maskU);
+            __m128i index = _mm_add_epi32(_mm_madd_epi16(yv, scaleYV), _mm_madd_epi16(u, scaleU));
+            _mm_store_si128(CIXEL_REINTERPRET_CAST(__m128i*)(indices), _mm_add_epi32(index, offset));
+            for(cixel_s32 k = 0; k < 4; ++k) {
+                cixel_s32 i = indices[k];
+                frequencies[i] += 1;
+                accColors[i].r_ += yuv[j + k].rgba_.r_;
+                accColors[i].g_ += yuv[j + k].rgba_.g_;
+                accColors[i].b_ += yuv[j + k].rgba_.b_;
+            }
+        }
+        _mm_store_si128(CIXEL_REINTERPRET_CAST(__m128i*)(minimums), minimum8);
+        _mm_store_si128(CIXEL_REINTERPRET_CAST(__m128i*)(maximums), maximum8);
+        if(0 < j) {
+            mergeBounds(&histogram->box_, minimums, maximums, 4);
+        }
+        accumulateRowScalar(histogram, yuv + j, width - j);
+    }
 
-            box->start_.x_ = minimum(box->start_.x_, r8);
-            box->start_.y_ = minimum(box->start_.y_, g8);
-            box->start_.z_ = minimum(box->start_.z_, b8);
+    CIXEL_TARGET_AVX2 CIXEL_STATIC void accumulateRowAVX2(Histogram* histogram, const Color* CIXEL_RESTRICT yuv, cixel_s32 width)
+    {
+        CIXEL_ALIGN(32) cixel_s32 indices[8];
+        CIXEL_ALIGN(32) cixel_u32 minimums[8];
+        CIXEL_ALIGN(32) cixel_u32 maximums[8];
+        const __m256i maskYV = _mm256_set1_epi32(0x001F001F);
+        const __m256i maskU = _mm256_set1_epi32(0x1F);
+        const __m256i scaleYV = _mm256_set1_epi32(packS16(UV_PLANE_SIZE, 1));
+        const __m256i scaleU = _mm256_set1_epi32(V_SIZE);
+        const __m256i offset = _mm256_set1_epi32(UV_PLANE_SIZE + V_SIZE + 1);
+        __m256i minimum8 = _mm256_set1_epi32(-1);
+        __m256i maximum8 = _mm256_setzero_si256();
+
+        cixel_u32* frequencies = histogram->frequencies_;
+        Color32* accColors = histogram->accColors_;
+        cixel_s32 j = 0;
+        for(; (j + 8) <= width; j += 8) {
+            __m256i p = _mm256_loadu_si256(CIXEL_REINTERPRET_CAST(const __m256i*)(yuv + j));
+            minimum8 = _mm256_min_epu8(minimum8, p);
+            maximum8 = _mm256_max_epu8(maximum8, p);
+            __m256i yv = _mm256_and_si256(_mm256_srli_epi32(p, SHIFT_Y), maskYV);
+            __m256i u = _mm256_and_si256(_mm256_srli_epi32(p, 8 + SHIFT_U), maskU);
+            __m256i index = _mm256_add_epi32(_mm256_madd_epi16(yv, scaleYV), _mm256_madd_epi16(u, scaleU));
+            _mm256_store_si256(CIXEL_REINTERPRET_CAST(__m256i*)(indices), _mm256_add_epi32(index, offset));
+            for(cixel_s32 k = 0; k < 8; ++k) {
+                cixel_s32 i = indices[k];
+                frequencies[i] += 1;
+                accColors[i].r_ += yuv[j + k].rgba_.r_;
+                accColors[i].g_ += yuv[j + k].rgba_.g_;
+                accColors[i].b_ += yuv[j + k].rgba_.b_;
+            }
+        }
+        _mm256_store_si256(CIXEL_REINTERPRET_CAST(__m256i*)(minimums), minimum8);
+        _mm256_store_si256(CIXEL_REINTERPRET_CAST(__m256i*)(maximums), maximum8);
+        if(0 < j) {
+            mergeBounds(&histogram->box_, minimums, maximums, 8);
+        }
+        accumulateRowScalar(histogram, yuv + j, width - j);
+    }
+#endif
 
-            box->end_.x_ = maximum(box->end_.x_, r8);
-            box->end_.y_ = maximum(box->end_.y_, g8);
-            box->end_.z_ = maximum(box->end_.z_, b8);
+    CIXEL_STATIC void getAccumulations(Cixel* cixel, Histogram* histogram, const cixel_u32* CIXEL_RESTRICT pixels, bool flipVertical, cixel_s32 rowStart, cixel_s32 rowEnd)
+    {
+        cixel_s32 width = cixel->width_;
+        for(cixel_s32 i = rowStart; i < rowEnd; ++i) {
+            Color* yuv = cixel->yuv_ + i * width;
+            const cixel_u32* src = pixels + (flipVertical ? (cixel->height_ - 1 - i) : i) * width;
+            cixel->kernels_.rgb2yuvRow_(CIXEL_REINTERPRET_CAST(cixel_u32*)(yuv), src, width);
+            cixel->kernels_.accumulateRow_(histogram, yuv, width);
         }
     }
 
-    CIXEL_STATIC void getAccumulationsFlipVertical(Cixel* cixel, Bucket* buckets, const cixel_u32* CIXEL_RESTRICT pixels)
+    CIXEL_STATIC void resetBox(BoxU8* box)
     {
-        cixel_s32 d = 0;
-        cixel_s32 s = (cixel->height_-1)*cixel->width_;
-        for(cixel_s32 i = 0; i<cixel->height_; ++i) {
-            for(cixel_s32 j = 0; j < cixel->width_; ++j) {
-                BoxU8* box = &buckets[0].box_;
-                cixel_s32 d0 = d+j;
-                cixel->yuv_[d0].color_ = cixelRGB2YUV(pixels[s+j]);
+        box->start_.x_ = CIXEL_STATIC_CAST(cixel_u8)(RESOLUTION_Y - 1);
+        box->start_.y_ = CIXEL_STATIC_CAST(cixel_u8)(RESOLUTION_U - 1);
+        box->start_.z_ = CIXEL_STATIC_CAST(cixel_u8)(RESOLUTION_V - 1);
+        box->start_.w_ = 0;
+        box->end_.x_ = 0;
+        box->end_.y_ = 0;
+        box->end_.z_ = 0;
+        box->end_.w_ = 0;
+    }
 
-                cixel_s32 qr = cixel->yuv_[d0].rgba_.r_ >> SHIFT_Y;
-                cixel_s32 qg = cixel->yuv_[d0].rgba_.g_ >> SHIFT_U;
-                cixel_s32 qb = cixel->yuv_[d0].rgba_.b_ >> SHIFT_V;
-                cixel_s32 index = (qr + 1) * UV_PLANE_SIZE + (qg + 1) * V_SIZE + qb + 1;
-                cixel->frequencies_[index] += 1;
+    /**
+    @brief Add a private histogram to the shared one, and clear the private one for the next use
+    */
+    CIXEL_STATIC void mergeHistogram(Histogram* dst, Histogram* src)
+    {
+        const BoxU8* box = &src->box_;
+        if(box->end_.x_ < box->start_.x_) {
+            return; // no pixels
+        }
+        for(cixel_s32 r = box->start_.x_ + 1; r <= box->end_.x_ + 1; ++r) {
+            for(cixel_s32 g = box->start_.y_ + 1; g <= box->end_.y_ + 1; ++g) {
+                cixel_s32 index = r * UV_PLANE_SIZE + g * V_SIZE;
+                for(cixel_s32 b = box->start_.z_ + 1; b <= box->end_.z_ + 1; ++b) {
+                    dst->frequencies_[index + b] += src->frequencies_[index + b];
+                    addColor32(&dst->accColors_[index + b], &src->accColors_[index + b]);
+                    src->frequencies_[index + b] = 0;
+                    src->accColors_[index + b].r_ = 0;
+                    src->accColors_[index + b].g_ = 0;
+                    src->accColors_[index + b].b_ = 0;
+                }
+            }
+        }
+        dst->box_.start_.x_ = minimum(dst->box_.start_.x_, box->start_.x_);
+        dst->box_.start_.y_ = minimum(dst->box_.start_.y_, box->start_.y_);
+        dst->box_.start_.z_ = minimum(dst->box_.start_.z_, box->start_.z_);
+        dst->box_.end_.x_ = maximum(dst->box_.end_.x_, box->end_.x_);
+        dst->box_.end_.y_ = maximum(dst->box_.end_.y_, box->end_.y_);
+        dst->box_.end_.z_ = maximum(dst->box_.end_.z_, box->end_.z_);
+    }
 
-                cixel->accColors_[index].r_ += cixel->yuv_[d0].rgba_.r_;
-                cixel->accColors_[index].g_ += cixel->yuv_[d0].rgba_.g_;
-                cixel->accColors_[index].b_ += cixel->yuv_[d0].rgba_.b_;
+    struct AccumulationJob_t
+    {
+        Cixel* cixel_;
+        Histogram* histogram_; //< shared histogram, used by the first job
+        const cixel_u32* pixels_;
+        bool flipVertical_;
+        cixel_s32 numJobs_;
+    };
 
-                cixel_u8 r8 = CIXEL_STATIC_CAST(cixel_u8)(qr);
-                cixel_u8 g8 = CIXEL_STATIC_CAST(cixel_u8)(qg);
-                cixel_u8 b8 = CIXEL_STATIC_CAST(cixel_u8)(qb);
+    typedef struct AccumulationJob_t AccumulationJob;
 
-                box->start_.x_ = minimum(box->start_.x_, r8);
-                box->start_.y_ = minimum(box->start_.y_, g8);
-                box->start_.z_ = minimum(box->start_.z_, b8);
+    CIXEL_STATIC void accumulationJob(void* args, cixel_s32 index)
+    {
+        AccumulationJob* job = CIXEL_REINTERPRET_CAST(AccumulationJob*)(args);
+        Cixel* cixel = job->cixel_;
+        Histogram* histogram = (0 == index) ? job->histogram_ : &cixel->histograms_[index - 1];
+        resetBox(&histogram->box_);
+        cixel_s32 rowStart = CIXEL_STATIC_CAST(cixel_s32)(CIXEL_STATIC_CAST(cixel_s64)(cixel->height_) * index / job->numJobs_);
+        cixel_s32 rowEnd = CIXEL_STATIC_CAST(cixel_s32)(CIXEL_STATIC_CAST(cixel_s64)(cixel->height_) * (index + 1) / job->numJobs_);
+        getAccumulations(cixel, histogram, job->pixels_, job->flipVertical_, rowStart, rowEnd);
+    }
 
-                box->end_.x_ = maximum(box->end_.x_, r8);
-                box->end_.y_ = maximum(box->end_.y_, g8);
-                box->end_.z_ = maximum(box->end_.z_, b8);
-            }
-            d += cixel->width_;
-            s -= cixel->width_;
+    //--- dst[i] += src[i]
+    CIXEL_STATIC void addRowScalar(cixel_u32* CIXEL_RESTRICT dst, const cixel_u32* CIXEL_RESTRICT src, cixel_s32 count)
+    {
+        for(cixel_s32 i = 0; i < count; ++i) {
+            dst[i] += src[i];
         }
     }
 
-    CIXEL_STATIC void calcPrefixSum(Cixel* cixel)
+#if defined(CIXEL_X86)
+    CIXEL_TARGET_SSE41 CIXEL_STATIC void addRowSSE41(cixel_u32* CIXEL_RESTRICT dst, const cixel_u32* CIXEL_RESTRICT src, cixel_s32 count)
     {
-        cixel_u32* frequencies = cixel->frequencies_;
-        Color32* accColors = cixel->accColors_;
+        cixel_s32 i = 0;
+        for(; (i + 4) <= count; i += 4) {
+            __m128i x0 = _mm_loadu_si128(CIXEL_REINTERPRET_CAST(const __m128i*)(dst + i));
+            __m128i x1 = _mm_loadu_si128(CIXEL_REINTERPRET_CAST(const __m128i*)(src + i));
+            _mm_storeu_si128(CIXEL_REINTERPRET_CAST(__m128i*)(dst + i), _mm_add_epi32(x0, x1));
+        }
+        addRowScalar(dst + i, src + i, count - i);
+    }
 
-        cixel_s32 row0 = 0;
-        for(cixel_s32 i = 1; i <= RESOLUTION_Y; ++i) {
-            cixel_s32 row1 = row0 + UV_PLANE_SIZE;
-            cixel_s32 col0 = 0;
-            for(cixel_s32 j = 1; j <= RESOLUTION_U; ++j) {
-                cixel_s32 col1 = col0 + V_SIZE;
-                cixel_s32 dep0 = 0;
-                for(cixel_s32 k = 1; k <= RESOLUTION_V; ++k) {
-                    cixel_s32 dep1 = k;
+    CIXEL_TARGET_AVX2 CIXEL_STATIC void addRowAVX2(cixel_u32* CIXEL_RESTRICT dst, const cixel_u32* CIXEL_RESTRICT src, cixel_s32 count)
+    {
+        cixel_s32 i = 0;
+        for(; (i + 8) <= count; i += 8) {
+            __m256i x0 = _mm256_loadu_si256(CIXEL_REINTERPRET_CAST(const __m256i*)(dst + i));
+            __m256i x1 = _mm256_loadu_si256(CIXEL_REINTERPRET_CAST(const __m256i*)(src + i));
+            _mm256_storeu_si256(CIXEL_REINTERPRET_CAST(__m256i*)(dst + i), _mm256_add_epi32(x0, x1));
+        }
+        addRowScalar(dst + i, src + i, count - i);
+    }
+#endif
 
-                    cixel_s32 index = row1 + col1 + dep1;
-                    CIXEL_ASSERT(0 <= index && index < FREQUENCY_SIZE);
-                    CIXEL_ASSERT(0 <= (row0 + col0 + dep0) && (row0 + col0 + dep0) < FREQUENCY_SIZE);
+    /**
+    @brief Convert histograms to summed-area tables
+    @param [in] box ... bounds of the histograms
+    @note The prefix sums are separable, scans along V, U, and then Y. Only cells queried by sub-boxes of the bounds are computed.
+    */
+    CIXEL_STATIC void calcPrefixSum(Cixel* cixel, const BoxU8* box)
+    {
+        cixel_u32* frequencies = cixel->frequencies_;
+        Color32* accColors = cixel->accColors_;
+        cixel_u32* accValues = CIXEL_REINTERPRET_CAST(cixel_u32*)(accColors);
+        void (*addRow)(cixel_u32* CIXEL_RESTRICT, const cixel_u32* CIXEL_RESTRICT, cixel_s32) = cixel->kernels_.addRow_;
+
+        // Cells below the bounds are zero
+        cixel_s32 y0 = box->start_.x_ + 1;
+        cixel_s32 y1 = box->end_.x_ + 1;
+        cixel_s32 u0 = box->start_.y_ + 1;
+        cixel_s32 u1 = box->end_.y_ + 1;
+        cixel_s32 v0 = box->start_.z_ + 1;
+        cixel_s32 v1 = box->end_.z_ + 1;
+        cixel_s32 count = v1 - v0 + 1;
+        for(cixel_s32 i = y0; i <= y1; ++i) {
+            cixel_s32 plane = i * UV_PLANE_SIZE;
+            for(cixel_s32 j = u0; j <= u1; ++j) {
+                cixel_s32 row = plane + j * V_SIZE;
+                for(cixel_s32 k = v0 + 1; k <= v1; ++k) {
+                    frequencies[row + k] += frequencies[row + k - 1];
+                    addColor32(&accColors[row + k], &accColors[row + k - 1]);
+                }
+            }
+            for(cixel_s32 j = u0 + 1; j <= u1; ++j) {
+                cixel_s32 row1 = plane + j * V_SIZE + v0;
+                cixel_s32 row0 = row1 - V_SIZE;
+                addRow(frequencies + row1, frequencies + row0, count);
+                addRow(accValues + row1 * 4, accValues + row0 * 4, count * 4);
+            }
+            if(y0 < i) {
+                for(cixel_s32 j = u0; j <= u1; ++j) {
+                    cixel_s32 row1 = plane + j * V_SIZE + v0;
+                    cixel_s32 row0 = row1 - UV_PLANE_SIZE;
+                    addRow(frequencies + row1, frequencies + row0, count);
+                    addRow(accValues + row1 * 4, accValues + row0 * 4, count * 4);
+                }
+            }
+        }
+    }
 
-                    frequencies[index] += frequencies[row0 + col0 + dep0];
+    /**
+    @brief Clear the cells of the tables touched by the last quantization
+    */
+    CIXEL_STATIC void clearTables(Cixel* cixel)
+    {
+        const BoxU8* box = &cixel->dirty_;
+        if(box->start_.x_ <= box->end_.x_) {
+            cixel_s32 count = box->end_.z_ - box->start_.z_ + 1;
+            for(cixel_s32 i = box->start_.x_; i <= box->end_.x_; ++i) {
+                for(cixel_s32 j = box->start_.y_; j <= box->end_.y_; ++j) {
+                    cixel_s32 row = (i + 1) * UV_PLANE_SIZE + (j + 1) * V_SIZE + box->start_.z_ + 1;
+                    memset(cixel->frequencies_ + row, 0, sizeof(cixel_u32) * count);
+                    memset(cixel->accColors_ + row, 0, sizeof(Color32) * count);
+                }
+            }
+            resetBox(&cixel->dirty_);
+        }
+    }
 
-                    frequencies[index] += frequencies[row0 + col1 + dep1];
-                    frequencies[index] += frequencies[row1 + col0 + dep1];
-                    frequencies[index] += frequencies[row1 + col1 + dep0];
+    /**
+    @brief Clear only the cells of the grid in the box of all pixels, which boxes of colors are put into
+    */
+    CIXEL_STATIC void clearGrid(Cixel* cixel, const BoxU8* box)
+    {
+        cixel->gridBox_ = *box;
+        if(box->end_.x_ < box->start_.x_) {
+            return;
+        }
+        cixel_s32 count = box->end_.z_ - box->start_.z_ + 1;
+        for(cixel_s32 i = box->start_.x_; i <= box->end_.x_; ++i) {
+            for(cixel_s32 j = box->start_.y_; j <= box->end_.y_; ++j) {
+                cixel_s32 cell = (i << GRID_SHIFT_Y) + (j << GRID_SHIFT_U) + box->start_.z_;
+                memset(cixel->grid_ + cell, -1, sizeof(cixel_s16) * count);
+            }
+        }
+    }
 
-                    frequencies[index] -= frequencies[row0 + col0 + dep1];
-                    frequencies[index] -= frequencies[row0 + col1 + dep0];
-                    frequencies[index] -= frequencies[row1 + col0 + dep0];
+    /**
+    @brief Collect occupied cells of the histogram, the cleared frequency table is used as a temporary map from a cell to its index plus one
+    @return number of cells
+    */
+    CIXEL_STATIC cixel_s32 getSparseAccumulations(Cixel* cixel, BoxU8* box, const cixel_u32* CIXEL_RESTRICT pixels, bool flipVertical)
+    {
+        cixel_s32 width = cixel->width_;
+        cixel_u32* map = cixel->frequencies_;
+        Cell* cells = cixel->cells_;
+        cixel_s32 numCells = 0;
+        resetBox(box);
+        for(cixel_s32 i = 0; i < cixel->height_; ++i) {
+            Color* yuv = cixel->yuv_ + i * width;
+            const cixel_u32* src = pixels + (flipVertical ? (cixel->height_ - 1 - i) : i) * width;
+            cixel->kernels_.rgb2yuvRow_(CIXEL_REINTERPRET_CAST(cixel_u32*)(yuv), src, width);
+            for(cixel_s32 j = 0; j < width; ++j) {
+                cixel_u8 qr = CIXEL_STATIC_CAST(cixel_u8)(yuv[j].rgba_.r_ >> SHIFT_Y);
+                cixel_u8 qg = CIXEL_STATIC_CAST(cixel_u8)(yuv[j].rgba_.g_ >> SHIFT_U);
+                cixel_u8 qb = CIXEL_STATIC_CAST(cixel_u8)(yuv[j].rgba_.b_ >> SHIFT_V);
+                cixel_s32 index = (qr + 1) * UV_PLANE_SIZE + (qg + 1) * V_SIZE + qb + 1;
+                if(0 == map[index]) {
+                    map[index] = CIXEL_STATIC_CAST(cixel_u32)(numCells + 1);
+                    Cell* cell = &cells[numCells];
+                    cell->point_.x_ = qr;
+                    cell->point_.y_ = qg;
+                    cell->point_.z_ = qb;
+                    cell->point_.w_ = 0;
+                    cell->frequency_ = 0;
+                    memset(&cell->accColor_, 0, sizeof(Color32));
+                    ++numCells;
+
+                    box->start_.x_ = minimum(box->start_.x_, qr);
+                    box->start_.y_ = minimum(box->start_.y_, qg);
+                    box->start_.z_ = minimum(box->start_.z_, qb);
+                    box->end_.x_ = maximum(box->end_.x_, qr);
+                    box->end_.y_ = maximum(box->end_.y_, qg);
+                    box->end_.z_ = maximum(box->end_.z_, qb);
+                }
+                Cell* cell = &cells[map[index] - 1];
+                cell->frequency_ += 1;
+                cell->accColor_.r_ += yuv[j].rgba_.r_;
+                cell->accColor_.g_ += yuv[j].rgba_.g_;
+                cell->accColor_.b_ += yuv[j].rgba_.b_;
+            }
+        }
+        for(cixel_s32 i = 0; i < numCells; ++i) {
+            const PointU8* point = &cells[i].point_;
+            map[(point->x_ + 1) * UV_PLANE_SIZE + (point->y_ + 1) * V_SIZE + point->z_ + 1] = 0;
+        }
+        return numCells;
+    }
 
-                    addColor32(&accColors[index], &accColors[row0 + col0 + dep0]);
+    /**
+    @brief Put cells into the histogram tables
+    */
+    CIXEL_STATIC void scatterCells(Cixel* cixel, cixel_s32 numCells)
+    {
+        for(cixel_s32 i = 0; i < numCells; ++i) {
+            const Cell* cell = &cixel->cells_[i];
+            cixel_s32 index = (cell->point_.x_ + 1) * UV_PLANE_SIZE + (cell->point_.y_ + 1) * V_SIZE + cell->point_.z_ + 1;
+            cixel->frequencies_[index] = cell->frequency_;
+            cixel->accColors_[index] = cell->accColor_;
+        }
+    }
 
-                    addColor32(&accColors[index], &accColors[row0 + col1 + dep1]);
-                    addColor32(&accColors[index], &accColors[row1 + col0 + dep1]);
-                    addColor32(&accColors[index], &accColors[row1 + col1 + dep0]);
+    CIXEL_STATIC cixel_s32 getVolume(const BoxU8* box)
+    {
+        if(box->end_.x_ < box->start_.x_) {
+            return 0;
+        }
+        return (box->end_.x_ - box->start_.x_ + 1) * (box->end_.y_ - box->start_.y_ + 1) * (box->end_.z_ - box->start_.z_ + 1);
+    }
 
-                    subColor32(&accColors[index], &accColors[row0 + col0 + dep1]);
-                    subColor32(&accColors[index], &accColors[row0 + col1 + dep0]);
-                    subColor32(&accColors[index], &accColors[row1 + col0 + dep0]);
+    CIXEL_STATIC cixel_u8 getAxis(const PointU8* point, cixel_s32 axis)
+    {
+        switch(axis) {
+        case 0:
+            return point->x_;
+        case 1:
+            return point->y_;
+        default:
+            return point->z_;
+        }
+    }
 
-                    dep0 = dep1;
-                }
-                col0 = col1;
-            }
-            row0 = row1;
+    /**
+    @brief Move cells whose coordinate along the axis is less than or equal to split before the others
+    @param [out] tmp ... work buffer for the range
+    @return start of the upper cells
+    */
+    CIXEL_STATIC cixel_s32 partitionCells(Cell* CIXEL_RESTRICT cells, Cell* CIXEL_RESTRICT tmp, cixel_s32 start, cixel_s32 end, cixel_s32 axis, cixel_u8 split)
+    {
+        cixel_s32 lower = 0;
+        cixel_s32 upper = end - start;
+        for(cixel_s32 i = start; i < end; ++i) {
+            cixel_s32 isLower = getAxis(&cells[i].point_, axis) <= split;
+            cixel_s32 index = isLower ? lower : (upper - 1);
+            tmp[index] = cells[i];
+            lower += isLower;
+            upper -= 1 - isLower;
         }
+        memcpy(cells + start, tmp, sizeof(Cell) * (end - start));
+        return start + lower;
     }
 
     CIXEL_STATIC cixel_u32 getSum(const Cixel* cixel, const BoxU8* box)
@@ -986,6 +1796,64 @@ CIXEL_NAMESPACE_EMPTY_BEGIN
         subColor32(rgb, &accColors[r0 + g0 + b0]);
     }
 
+    CIXEL_STATIC void getBucketSumRGB(const Cixel* cixel, cixel_u32* count, Color32* rgb, const Bucket* bucket)
+    {
+        if(!cixel->sparse_) {
+            getSumRGB(cixel, count, rgb, &bucket->box_);
+            return;
+        }
+        *count = 0;
+        memset(rgb, 0, sizeof(Color32));
+        for(cixel_s32 i = bucket->cellStart_; i < bucket->cellEnd_; ++i) {
+            *count += cixel->cells_[i].frequency_;
+            addColor32(rgb, &cixel->cells_[i].accColor_);
+        }
+    }
+
+    CIXEL_STATIC cixel_u32 getBucketSum(const Cixel* cixel, const Bucket* bucket)
+    {
+        if(!cixel->sparse_) {
+            return getSum(cixel, &bucket->box_);
+        }
+        cixel_u32 count = 0;
+        for(cixel_s32 i = bucket->cellStart_; i < bucket->cellEnd_; ++i) {
+            count += cixel->cells_[i].frequency_;
+        }
+        return count;
+    }
+
+    CIXEL_STATIC void project(const Cixel* cixel, Projection* projection, const Bucket* bucket)
+    {
+        memset(projection, 0, sizeof(Projection));
+        for(cixel_s32 i = bucket->cellStart_; i < bucket->cellEnd_; ++i) {
+            const Cell* cell = &cixel->cells_[i];
+            projection->frequencies_[0][cell->point_.x_] += cell->frequency_;
+            projection->frequencies_[1][cell->point_.y_] += cell->frequency_;
+            projection->frequencies_[2][cell->point_.z_] += cell->frequency_;
+            addColor32(&projection->accColors_[0][cell->point_.x_], &cell->accColor_);
+            addColor32(&projection->accColors_[1][cell->point_.y_], &cell->accColor_);
+            addColor32(&projection->accColors_[2][cell->point_.z_], &cell->accColor_);
+        }
+    }
+
+    /**
+    @brief Sum of a sub-box of a bucket, which is sliced only along the axis
+    */
+    CIXEL_STATIC void getSliceSumRGB(const Cixel* cixel, cixel_u32* count, Color32* rgb, const Projection* projection, const BoxU8* box, cixel_s32 axis)
+    {
+        if(!cixel->sparse_) {
+            getSumRGB(cixel, count, rgb, box);
+            return;
+        }
+        *count = 0;
+        memset(rgb, 0, sizeof(Color32));
+        cixel_s32 end = getAxis(&box->end_, axis);
+        for(cixel_s32 i = getAxis(&box->start_, axis); i <= end; ++i) {
+            *count += projection->frequencies_[axis][i];
+            addColor32(rgb, &projection->accColors_[axis][i]);
+        }
+    }
+
     CIXEL_STATIC void calcCentroid(cixel_u32 count, Color32* rgb)
     {
         if(0 < count) {
@@ -1061,9 +1929,14 @@ CIXEL_NAMESPACE_EMPTY_BEGIN
         CIXEL_ASSERT(box.start_.y_ <= box.end_.y_);
         CIXEL_ASSERT(box.start_.z_ <= box.end_.z_);
 
+        Projection projection;
+        if(cixel->sparse_) {
+            project(cixel, &projection, src);
+        }
+
         cixel_u32 count;
         Color32 rgb;
-        getSumRGB(cixel, &count, &rgb, &box);
+        getSliceSumRGB(cixel, &count, &rgb, &projection, &box, 0);
         calcCentroid(count, &rgb);
 
         cixel_u8 mid[3];
@@ -1085,13 +1958,13 @@ CIXEL_NAMESPACE_EMPTY_BEGIN
             b0 = box;
             b0.start_.x_ = box.start_.x_;
             b0.end_.x_ = mid[0];
-            getSumRGB(cixel, &count0, &rgb0, &b0);
+            getSliceSumRGB(cixel, &count0, &rgb0, &projection, &b0, 0);
             calcCentroid(count0, &rgb0);
 
             b1 = box;
             b1.start_.x_ = mid[0];
             b1.end_.x_ = b1.end_.x_;
-            getSumRGB(cixel, &count1, &rgb1, &b1);
+            getSliceSumRGB(cixel, &count1, &rgb1, &projection, &b1, 0);
             calcCentroid(count1, &rgb1);
 
             axis = 0;
@@ -1105,13 +1978,13 @@ CIXEL_NAMESPACE_EMPTY_BEGIN
             b0 = box;
             b0.start_.y_ = box.start_.y_;
             b0.end_.y_ = mid[1];
-            getSumRGB(cixel, &count0, &rgb0, &b0);
+            getSliceSumRGB(cixel, &count0, &rgb0, &projection, &b0, 1);
             calcCentroid(count0, &rgb0);
 
             b1 = box;
             b1.start_.y_ = mid[1];
             b1.end_.y_ = box.end_.y_;
-            getSumRGB(cixel, &count1, &rgb1, &b1);
+            getSliceSumRGB(cixel, &count1, &rgb1, &projection, &b1, 1);
             calcCentroid(count1, &rgb1);
 
             cixel_u32 tsqrDistances = calcSquaredDistance(count0, &rgb0, count1, &rgb1, &rgb);
@@ -1127,13 +2000,13 @@ CIXEL_NAMESPACE_EMPTY_BEGIN
             b0 = box;
             b0.start_.z_ = box.start_.z_;
             b0.end_.z_ = mid[2];
-            getSumRGB(cixel, &count0, &rgb0, &b0);
+            getSliceSumRGB(cixel, &count0, &rgb0, &projection, &b0, 2);
             calcCentroid(count0, &rgb0);
 
             b1 = box;
             b1.start_.z_ = mid[2];
             b1.end_.z_ = box.end_.z_;
-            getSumRGB(cixel, &count1, &rgb1, &b1);
+            getSliceSumRGB(cixel, &count1, &rgb1, &projection, &b1, 2);
             calcCentroid(count1, &rgb1);
 
             cixel_u32 tsqrDistances = calcSquaredDistance(count0, &rgb0, count1, &rgb1, &rgb);
@@ -1186,41 +2059,76 @@ CIXEL_NAMESPACE_EMPTY_BEGIN
             break;
         }
 #endif
-        bucket0->frequency_ = getSum(cixel, &bucket0->box_);
-        bucket1->frequency_ = getSum(cixel, &bucket1->box_);
+        if(cixel->sparse_) {
+            cixel_s32 cellStart = src->cellStart_;
+            cixel_s32 cellEnd = src->cellEnd_;
+            cixel_s32 cellMid = partitionCells(cixel->cells_, cixel->cells_ + cixel->width_ * cixel->height_, cellStart, cellEnd, axis, split0);
+            bucket0->cellStart_ = cellStart;
+            bucket0->cellEnd_ = cellMid;
+            bucket1->cellStart_ = cellMid;
+            bucket1->cellEnd_ = cellEnd;
+            bucket0->frequency_ = 0;
+            for(cixel_s32 i = bstart; i <= split0; ++i) {
+                bucket0->frequency_ += projection.frequencies_[axis][i];
+            }
+            bucket1->frequency_ = count - bucket0->frequency_;
+        } else {
+            bucket0->frequency_ = getSum(cixel, &bucket0->box_);
+            bucket1->frequency_ = getSum(cixel, &bucket1->box_);
+        }
 
         return true;
     }
 
-    CIXEL_STATIC void sortToUpper(cixel_s32 index, cixel_s32 size, Bucket* buckets)
+    CIXEL_STATIC void setPriority(const Cixel* cixel, Bucket* bucket)
     {
-        for(cixel_s32 i = index + 1; i < size; ++i) {
-            if(buckets[i].frequency_ <= buckets[i-1].frequency_) {
-                return;
+        bucket->priority_ = (CIXEL_NULL == cixel->priorityFunc_) ? bucket->frequency_ : cixel->priorityFunc_(&bucket->box_, bucket->frequency_);
+    }
+
+    //--- Max-heap of buckets ordered by priority
+    CIXEL_STATIC void pushHeap(Bucket* buckets, cixel_s32 size, const Bucket* bucket)
+    {
+        cixel_s32 i = size;
+        while(0 < i) {
+            cixel_s32 parent = (i - 1) >> 1;
+            if(bucket->priority_ <= buckets[parent].priority_) {
+                break;
             }
-            Bucket tmp = buckets[i];
-            buckets[i] = buckets[i-1];
-            buckets[i-1] = tmp;
+            buckets[i] = buckets[parent];
+            i = parent;
         }
+        buckets[i] = *bucket;
     }
 
-    CIXEL_STATIC void sortToLower(cixel_s32 start, cixel_s32 index, Bucket* buckets)
+    CIXEL_STATIC void popHeap(Bucket* buckets, cixel_s32 size, Bucket* top)
     {
-        for(cixel_s32 i = index; start < i; --i) {
-            if(buckets[i].frequency_ <= buckets[i-1].frequency_) {
-                return;
+        CIXEL_ASSERT(0 < size);
+        *top = buckets[0];
+        --size;
+        Bucket last = buckets[size];
+        cixel_s32 i = 0;
+        for(;;) {
+            cixel_s32 child = (i << 1) + 1;
+            if(size <= child) {
+                break;
+            }
+            if((child + 1) < size && buckets[child].priority_ < buckets[child + 1].priority_) {
+                ++child;
             }
-            Bucket tmp = buckets[i];
-            buckets[i] = buckets[i-1];
-            buckets[i-1] = tmp;
+            if(buckets[child].priority_ <= last.priority_) {
+                break;
+            }
+            buckets[i] = buckets[child];
+            i = child;
         }
+        buckets[i] = last;
     }
 
-    CIXEL_STATIC bool calcCenterColor(const Cixel* cixel, Color* color, const BoxU8* box)
+    CIXEL_STATIC bool calcCenterColor(const Cixel* cixel, Color* color, const Bucket* bucket)
     {
         cixel_u32 count;
         Color32 rgb;
-        getSumRGB(cixel, &count, &rgb, box);
+        getBucketSumRGB(cixel, &count, &rgb, bucket);
 
         if(0 < count) {
             cixel_u32 r = ((rgb.r_ << 1) / count + 1) >> 1;
@@ -1241,6 +2149,7 @@ CIXEL_NAMESPACE_EMPTY_BEGIN
     {
         CIXEL_ASSERT(cixel->size_ < MAX_COLORS);
         cixel->colors_[cixel->size_] = color;
+        cixel->pallet_[cixel->size_].color_ = YUV2RGBFixed(color.color_);
 
         cixel_u8 us = CIXEL_STATIC_CAST(cixel_u8)(cixel->size_);
         for(cixel_s32 r = box->start_.x_; r <= box->end_.x_; ++r) {
@@ -1255,286 +2164,727 @@ CIXEL_NAMESPACE_EMPTY_BEGIN
         ++cixel->size_;
     }
 
-#if defined(CIXEL_SSE)
-    //-----------------------------------------------------------
-    CIXEL_STATIC void diffuseRight(Cixel* cixel, cixel_u8* CIXEL_RESTRICT indices, cixel_s32 width2, cixel_s32 y,
-        const __m128i* zero, const __m128i* c255,
-        const __m128i* cK12YUV655, const __m128i* cK20YUV655,
-        const __m128i* cK21YUV655, const __m128i* cK22YUV655)
+    CIXEL_STATIC inline cixel_s32 getAxisDistance(cixel_s32 x, cixel_s32 start, cixel_s32 end)
     {
-        cixel_s32 width = cixel->width_;
-
-        const Color* yuv = cixel->yuv_;
-        const Color* colors = cixel->colors_;
-        const cixel_s16* grid = cixel->grid_;
-        ColorS32* errors = cixel->errors_;
-
-        CIXEL_ALIGN(16) cixel_s32 tmp[4];
-
-        cixel_s32 index0 = y * width;
-        cixel_s32 index1 = y * width2 + 1;
-        for(cixel_s32 j = 0; j < width; ++j, ++index0, ++index1) {
-            __m128i i0 = _mm_cvtsi32_si128(*((cixel_s32*)&yuv[index0]));
-            i0 = _mm_unpacklo_epi8(i0, *zero);
-            i0 = _mm_unpacklo_epi16(i0, *zero);
+        return (x < start) ? (start - x) : (end < x) ? (x - end) : 0;
+    }
 
-            __m128i error = _mm_load_si128((const __m128i*)&errors[index1]);
-            error = _mm_add_epi32(error, _mm_slli_epi32(i0, 4));
-            error = _mm_srai_epi32(error, 4);
-            error = _mm_max_epi32(error, *zero);
-            error = _mm_min_epi32(error, *c255);
-            _mm_store_si128((__m128i*)tmp, error);
+    CIXEL_STATIC inline cixel_s32 getFarAxisDistance(cixel_s32 x, cixel_s32 start, cixel_s32 end)
+    {
+        cixel_s32 d0 = x - start;
+        cixel_s32 d1 = end - x;
+        return maximum(d0, d1);
+    }
 
-            cixel_s32 index = ((tmp[0] >> SHIFT_Y) << GRID_SHIFT_Y) + ((tmp[1] >> SHIFT_U) << GRID_SHIFT_U) + (tmp[2] >> SHIFT_V);
-            if(0 <= grid[index]) {
-                indices[index0] = CIXEL_STATIC_CAST(cixel_u8)(grid[index]);
+    /**
+    @brief Colors which can be the nearest to a cell of a block, the others are farther than the farthest cell from some color
+    @param [in] y,u,v ... the first cell of the block
+    @param [in] size ... cells along each axis of the block
+    @return number of candidates, which are in the order of the colors
+    */
+    CIXEL_STATIC cixel_s32 getCandidates(const Cixel* cixel, cixel_u8* CIXEL_RESTRICT candidates, const cixel_u8* CIXEL_RESTRICT colors, cixel_s32 numColors, cixel_s32 y, cixel_s32 u, cixel_s32 v, cixel_s32 size)
+    {
+        // Centers of the cells of the block
+        cixel_s32 y0 = (y << SHIFT_Y) + (1 << (SHIFT_Y - 1));
+        cixel_s32 u0 = (u << SHIFT_U) + (1 << (SHIFT_U - 1));
+        cixel_s32 v0 = (v << SHIFT_V) + (1 << (SHIFT_V - 1));
+        cixel_s32 y1 = y0 + ((size - 1) << SHIFT_Y);
+        cixel_s32 u1 = u0 + ((size - 1) << SHIFT_U);
+        cixel_s32 v1 = v0 + ((size - 1) << SHIFT_V);
+
+        cixel_s32 minDistances[MAX_COLORS];
+        cixel_s32 threshold = 0x7FFFFFFF;
+        for(cixel_s32 i = 0; i < numColors; ++i) {
+            const Color* color = &cixel->colors_[colors[i]];
+            cixel_s32 dy = getAxisDistance(color->rgba_.r_, y0, y1);
+            cixel_s32 du = getAxisDistance(color->rgba_.g_, u0, u1);
+            cixel_s32 dv = getAxisDistance(color->rgba_.b_, v0, v1);
+            minDistances[i] = dy * dy + du * du + dv * dv;
+            dy = getFarAxisDistance(color->rgba_.r_, y0, y1);
+            du = getFarAxisDistance(color->rgba_.g_, u0, u1);
+            dv = getFarAxisDistance(color->rgba_.b_, v0, v1);
+            threshold = minimum(threshold, dy * dy + du * du + dv * dv);
+        }
+        cixel_s32 count = 0;
+        for(cixel_s32 i = 0; i < numColors; ++i) {
+            if(minDistances[i] <= threshold) {
+                candidates[count] = colors[i];
+                ++count;
+            }
+        }
+        return count;
+    }
 
-                __m128i t0 = _mm_cvtsi32_si128(*((cixel_s32*)&colors[indices[index0]]));
-                t0 = _mm_unpacklo_epi8(t0, *zero);
-                t0 = _mm_unpacklo_epi16(t0, *zero);
+    //--- A key is (distance << 8) | index, so that the nearest color of the lowest index has the minimum key
+    CIXEL_STATIC cixel_s32 findNearestScalar(const Candidates* candidates, cixel_s32 y, cixel_s32 u, cixel_s32 v)
+    {
+        cixel_s32 cy = (y << SHIFT_Y) + (1 << (SHIFT_Y - 1));
+        cixel_s32 cu = (u << SHIFT_U) + (1 << (SHIFT_U - 1));
+        cixel_s32 cv = (v << SHIFT_V) + (1 << (SHIFT_V - 1));
+        cixel_s32 best = 0x7FFFFFFF;
+        for(cixel_s32 i = 0; i < candidates->size_; ++i) {
+            cixel_s32 dy = candidates->y_[i] - cy;
+            cixel_s32 du = candidates->u_[i] - cu;
+            cixel_s32 dv = candidates->v_[i] - cv;
+            cixel_s32 key = ((dy * dy + du * du + dv * dv) << 8) | candidates->indices_[i];
+            best = minimum(best, key);
+        }
+        return best & 0xFF;
+    }
 
-                error = _mm_sub_epi32(i0, t0);
+#if defined(CIXEL_X86)
+    CIXEL_TARGET_SSE41 CIXEL_STATIC cixel_s32 findNearestSSE41(const Candidates* candidates, cixel_s32 y, cixel_s32 u, cixel_s32 v)
+    {
+        const __m128i cy = _mm_set1_epi32((y << SHIFT_Y) + (1 << (SHIFT_Y - 1)));
+        const __m128i cu = _mm_set1_epi32((u << SHIFT_U) + (1 << (SHIFT_U - 1)));
+        const __m128i cv = _mm_set1_epi32((v << SHIFT_V) + (1 << (SHIFT_V - 1)));
+        __m128i best = _mm_set1_epi32(0x7FFFFFFF);
+        for(cixel_s32 i = 0; i < candidates->size_; i += 4) {
+            __m128i dy = _mm_sub_epi32(_mm_load_si128(CIXEL_REINTERPRET_CAST(const __m128i*)(candidates->y_ + i)), cy);
+            __m128i du = _mm_sub_epi32(_mm_load_si128(CIXEL_REINTERPRET_CAST(const __m128i*)(candidates->u_ + i)), cu);
+            __m128i dv = _mm_sub_epi32(_mm_load_si128(CIXEL_REINTERPRET_CAST(const __m128i*)(candidates->v_ + i)), cv);
+            __m128i distance = _mm_add_epi32(_mm_add_epi32(_mm_mullo_epi32(dy, dy), _mm_mullo_epi32(du, du)), _mm_mullo_epi32(dv, dv));
+            __m128i key = _mm_or_si128(_mm_slli_epi32(distance, 8), _mm_load_si128(CIXEL_REINTERPRET_CAST(const __m128i*)(candidates->indices_ + i)));
+            best = _mm_min_epi32(best, key);
+        }
+        best = _mm_min_epi32(best, _mm_shuffle_epi32(best, _MM_SHUFFLE(1, 0, 3, 2)));
+        best = _mm_min_epi32(best, _mm_shuffle_epi32(best, _MM_SHUFFLE(2, 3, 0, 1)));
+        return _mm_cvtsi128_si32(best) & 0xFF;
+    }
 
-                muladdDiffustion(&errors[index1 - 1], cK12YUV655, &error);
-                muladdDiffustion(&errors[index1 + width2 - 1], cK22YUV655, &error);
-                muladdDiffustion(&errors[index1 + width2], cK21YUV655, &error);
-                muladdDiffustion(&errors[index1 + width2 + 1], cK20YUV655, &error);
+    CIXEL_TARGET_AVX2 CIXEL_STATIC cixel_s32 findNearestAVX2(const Candidates* candidates, cixel_s32 y, cixel_s32 u, cixel_s32 v)
+    {
+        const __m256i cy = _mm256_set1_epi32((y << SHIFT_Y) + (1 << (SHIFT_Y - 1)));
+        const __m256i cu = _mm256_set1_epi32((u << SHIFT_U) + (1 << (SHIFT_U - 1)));
+        const __m256i cv = _mm256_set1_epi32((v << SHIFT_V) + (1 << (SHIFT_V - 1)));
+        __m256i best = _mm256_set1_epi32(0x7FFFFFFF);
+        for(cixel_s32 i = 0; i < candidates->size_; i += 8) {
+            __m256i dy = _mm256_sub_epi32(_mm256_load_si256(CIXEL_REINTERPRET_CAST(const __m256i*)(candidates->y_ + i)), cy);
+            __m256i du = _mm256_sub_epi32(_mm256_load_si256(CIXEL_REINTERPRET_CAST(const __m256i*)(candidates->u_ + i)), cu);
+            __m256i dv = _mm256_sub_epi32(_mm256_load_si256(CIXEL_REINTERPRET_CAST(const __m256i*)(candidates->v_ + i)), cv);
+            __m256i distance = _mm256_add_epi32(_mm256_add_epi32(_mm256_mullo_epi32(dy, dy), _mm256_mullo_epi32(du, du)), _mm256_mullo_epi32(dv, dv));
+            __m256i key = _mm256_or_si256(_mm256_slli_epi32(distance, 8), _mm256_load_si256(CIXEL_REINTERPRET_CAST(const __m256i*)(candidates->indices_ + i)));
+            best = _mm256_min_epi32(best, key);
+        }
+        __m128i best4 = _mm_min_epi32(_mm256_castsi256_si128(best), _mm256_extracti128_si256(best, 1));
+        best4 = _mm_min_epi32(best4, _mm_shuffle_epi32(best4, _MM_SHUFFLE(1, 0, 3, 2)));
+        best4 = _mm_min_epi32(best4, _mm_shuffle_epi32(best4, _MM_SHUFFLE(2, 3, 0, 1)));
+        return _mm_cvtsi128_si32(best4) & 0xFF;
+    }
+#endif
 
-            } else {
-                _mm_store_si128((__m128i*)tmp, i0);
-                index = ((tmp[0] >> SHIFT_Y) << GRID_SHIFT_Y) + ((tmp[1] >> SHIFT_U) << GRID_SHIFT_U) + (tmp[2] >> SHIFT_V);
-                indices[index0] = CIXEL_STATIC_CAST(cixel_u8)(grid[index]);
-                CIXEL_ASSERT(0 <= grid[index]);
+    /**
+    @brief Fill cells of a block not covered by boxes, the block is split into eight until one color is left
+    @param [in] colors ... candidates of the parent block
+    */
+    CIXEL_STATIC void fillBlock(Cixel* cixel, const cixel_u8* colors, cixel_s32 numColors, cixel_s32 y, cixel_s32 u, cixel_s32 v, cixel_s32 size)
+    {
+        cixel_u8 candidates[MAX_COLORS];
+        cixel_s32 numCandidates = getCandidates(cixel, candidates, colors, numColors, y, u, v, size);
+        if(1 < numCandidates && GRID_BLOCK < size) {
+            cixel_s32 half = size >> 1;
+            for(cixel_s32 i = 0; i < 8; ++i) {
+                fillBlock(cixel, candidates, numCandidates, y + ((i >> 2) & 1) * half, u + ((i >> 1) & 1) * half, v + (i & 1) * half, half);
+            }
+            return;
+        }
+        Candidates set;
+        for(cixel_s32 i = 0; i < numCandidates; ++i) {
+            const Color* color = &cixel->colors_[candidates[i]];
+            set.y_[i] = color->rgba_.r_;
+            set.u_[i] = color->rgba_.g_;
+            set.v_[i] = color->rgba_.b_;
+            set.indices_[i] = candidates[i];
+        }
+        set.size_ = (numCandidates + 7) & ~7;
+        for(cixel_s32 i = numCandidates; i < set.size_; ++i) {
+            set.y_[i] = set.y_[0];
+            set.u_[i] = set.u_[0];
+            set.v_[i] = set.v_[0];
+            set.indices_[i] = set.indices_[0];
+        }
+        // Cells out of the box keep colors of former quantizations, so they are overwritten without a clear
+        cixel_s16* grid = cixel->grid_;
+        const BoxU8* box = &cixel->gridBox_;
+        for(cixel_s32 i = y; i < (y + size); ++i) {
+            for(cixel_s32 j = u; j < (u + size); ++j) {
+                cixel_s16* row = grid + (i << GRID_SHIFT_Y) + (j << GRID_SHIFT_U);
+                bool inBox = box->start_.x_ <= i && i <= box->end_.x_ && box->start_.y_ <= j && j <= box->end_.y_;
+                for(cixel_s32 k = v; k < (v + size); ++k) {
+                    bool covered = inBox && box->start_.z_ <= k && k <= box->end_.z_ && 0 <= row[k];
+                    if(!covered) {
+                        row[k] = CIXEL_STATIC_CAST(cixel_s16)(cixel->kernels_.findNearest_(&set, i, j, k));
+                    }
+                }
             }
-        } // for(cixel_s32 j=0
+        }
     }
 
-    //-----------------------------------------------------------
-    CIXEL_STATIC void diffuseLeft(Cixel* cixel, cixel_u8* CIXEL_RESTRICT indices, cixel_s32 width2, cixel_s32 y,
-        const __m128i* zero, const __m128i* c255,
-        const __m128i* cK12YUV655, const __m128i* cK20YUV655,
-        const __m128i* cK21YUV655, const __m128i* cK22YUV655)
+    /**
+    @brief Fill cells not covered by boxes with the nearest colors to their centers, so that every cell of the grid is a valid index
+    @note Blocks of the grid narrow down candidates of the nearest colors, and a cell is compared only with the candidates of its block
+    */
+    CIXEL_STATIC void fillGrid(Cixel* cixel)
     {
-        cixel_s32 width = cixel->width_;
+        if(cixel->size_ <= 0) {
+            return;
+        }
+        cixel_u8 colors[MAX_COLORS];
+        for(cixel_s32 i = 0; i < cixel->size_; ++i) {
+            colors[i] = CIXEL_STATIC_CAST(cixel_u8)(i);
+        }
+        fillBlock(cixel, colors, cixel->size_, 0, 0, 0, RESOLUTION_Y);
+    }
 
-        const Color* yuv = cixel->yuv_;
-        const Color* colors = cixel->colors_;
-        const cixel_s16* grid = cixel->grid_;
-        ColorS32* errors = cixel->errors_;
+    CIXEL_STATIC inline cixel_s32 countTrailingZeros(cixel_u32 x)
+    {
+        CIXEL_ASSERT(0 != x);
+#if defined(_MSC_VER) && !defined(__clang__)
+        unsigned long index;
+        _BitScanForward(&index, x);
+        return CIXEL_STATIC_CAST(cixel_s32)(index);
+#elif defined(__GNUC__) || defined(__clang__)
+        return __builtin_ctz(x);
+#else
+        cixel_s32 count = 0;
+        for(; 0 == (x & 0x01U); x >>= 1) {
+            ++count;
+        }
+        return count;
+#endif
+    }
 
-        CIXEL_ALIGN(16) cixel_s32 tmp[4];
+    //--- Exact pallet for images of few colors
+    CIXEL_STATIC inline cixel_s32 hashColor(cixel_u32 key)
+    {
+        return CIXEL_STATIC_CAST(cixel_s32)((key * 0x9E3779B1U) >> (32 - COLOR_TABLE_SHIFT)) << 2;
+    }
 
-        cixel_s32 index0 = y * width + width - 1;
-        cixel_s32 index1 = y * width2 + width;
-        for(cixel_s32 j = width; 1 <= j; --j, --index0, --index1) {
-            __m128i i0 = _mm_cvtsi32_si128(*((cixel_s32*)&yuv[index0]));
-            i0 = _mm_unpacklo_epi8(i0, *zero);
-            i0 = _mm_unpacklo_epi16(i0, *zero);
+    CIXEL_STATIC inline cixel_s32 insertColor(ColorTable* table, cixel_s32 slot, cixel_u32 key)
+    {
+        if(table->capacity_ <= table->size_) {
+            return -1;
+        }
+        table->keys_[slot] = key;
+        table->values_[slot] = CIXEL_STATIC_CAST(cixel_u8)(table->size_);
+        table->colors_[table->size_] = key;
+        return table->size_++;
+    }
 
-            __m128i error = _mm_load_si128((const __m128i*)&errors[index1]);
-            error = _mm_add_epi32(error, _mm_slli_epi32(i0, 4));
-            error = _mm_srai_epi32(error, 4);
-            error = _mm_max_epi32(error, *zero);
-            error = _mm_min_epi32(error, *c255);
-            _mm_store_si128((__m128i*)tmp, error);
+    /**
+    @return index of the color, or -1 if the table is full
+    */
+    CIXEL_STATIC cixel_s32 findColorScalar(ColorTable* table, cixel_u32 key)
+    {
+        cixel_s32 group = hashColor(key);
+        for(;;) {
+            for(cixel_s32 i = 0; i < 4; ++i) {
+                cixel_u32 k = table->keys_[group + i];
+                if(key == k) {
+                    return table->values_[group + i];
+                }
+                if(COLOR_EMPTY == k) {
+                    return insertColor(table, group + i, key);
+                }
+            }
+            group = (group + 4) & (COLOR_TABLE_SIZE - 1);
+        }
+    }
 
-            cixel_s32 index = ((tmp[0] >> SHIFT_Y) << GRID_SHIFT_Y) + ((tmp[1] >> SHIFT_U) << GRID_SHIFT_U) + (tmp[2] >> SHIFT_V);
-            if(0 <= grid[index]) {
-                indices[index0] = CIXEL_STATIC_CAST(cixel_u8)(grid[index]);
+    CIXEL_STATIC bool mapColorRowScalar(ColorTable* table, cixel_u8* CIXEL_RESTRICT indices, const cixel_u32* CIXEL_RESTRICT pixels, cixel_s32 count)
+    {
+        cixel_u32 last = COLOR_EMPTY;
+        cixel_s32 index = 0;
+        for(cixel_s32 i = 0; i < count; ++i) {
+            cixel_u32 key = pixels[i] & 0x00FFFFFFU;
+            if(key != last) {
+                index = findColorScalar(table, key);
+                if(index < 0) {
+                    return false;
+                }
+                last = key;
+            }
+            indices[i] = CIXEL_STATIC_CAST(cixel_u8)(index);
+        }
+        return true;
+    }
 
-                __m128i t0 = _mm_cvtsi32_si128(*((cixel_s32*)&colors[indices[index0]]));
-                t0 = _mm_unpacklo_epi8(t0, *zero);
-                t0 = _mm_unpacklo_epi16(t0, *zero);
+#if defined(CIXEL_X86)
+    CIXEL_TARGET_SSE41 CIXEL_STATIC cixel_s32 findColorSSE41(ColorTable* table, cixel_u32 key)
+    {
+        const __m128i k = _mm_set1_epi32(CIXEL_STATIC_CAST(int)(key));
+        const __m128i empty = _mm_set1_epi32(-1);
+        cixel_s32 group = hashColor(key);
+        for(;;) {
+            __m128i keys = _mm_load_si128(CIXEL_REINTERPRET_CAST(const __m128i*)(table->keys_ + group));
+            cixel_u32 found = CIXEL_STATIC_CAST(cixel_u32)(_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(keys, k))));
+            if(0 != found) {
+                return table->values_[group + countTrailingZeros(found)];
+            }
+            // Slots are filled in order of probing, so an empty slot ends the probe
+            cixel_u32 vacant = CIXEL_STATIC_CAST(cixel_u32)(_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(keys, empty))));
+            if(0 != vacant) {
+                return insertColor(table, group + countTrailingZeros(vacant), key);
+            }
+            group = (group + 4) & (COLOR_TABLE_SIZE - 1);
+        }
+    }
 
-                error = _mm_sub_epi32(i0, t0);
+    CIXEL_TARGET_SSE41 CIXEL_STATIC bool mapColorRowSSE41(ColorTable* table, cixel_u8* CIXEL_RESTRICT indices, const cixel_u32* CIXEL_RESTRICT pixels, cixel_s32 count)
+    {
+        cixel_u32 last = COLOR_EMPTY;
+        cixel_s32 index = 0;
+        for(cixel_s32 i = 0; i < count; ++i) {
+            cixel_u32 key = pixels[i] & 0x00FFFFFFU;
+            if(key != last) {
+                index = findColorSSE41(table, key);
+                if(index < 0) {
+                    return false;
+                }
+                last = key;
+            }
+            indices[i] = CIXEL_STATIC_CAST(cixel_u8)(index);
+        }
+        return true;
+    }
+#endif
 
-                muladdDiffustion(&errors[index1 - 1], cK12YUV655, &error);
-                muladdDiffustion(&errors[index1 + width2 - 1], cK20YUV655, &error);
-                muladdDiffustion(&errors[index1 + width2], cK21YUV655, &error);
-                muladdDiffustion(&errors[index1 + width2 + 1], cK22YUV655, &error);
+    /**
+    @brief Map pixels to an exact pallet, if the image has no more colors than a pallet
+    @return false if the image has too many colors
+    */
+    CIXEL_STATIC bool mapColors(Cixel* cixel, cixel_u8* CIXEL_RESTRICT indices, const cixel_u32* CIXEL_RESTRICT pixels, bool flipVertical)
+    {
+        ColorTable* table = cixel->colorTable_;
+        memset(table->keys_, 0xFF, sizeof(table->keys_));
+        table->size_ = 0;
+        table->capacity_ = cixel->maxColors_;
 
-            } else {
-                _mm_store_si128((__m128i*)tmp, i0);
-                index = ((tmp[0] >> SHIFT_Y) << GRID_SHIFT_Y) + ((tmp[1] >> SHIFT_U) << GRID_SHIFT_U) + (tmp[2] >> SHIFT_V);
-                indices[index0] = CIXEL_STATIC_CAST(cixel_u8)(grid[index]);
-                CIXEL_ASSERT(0 <= grid[index]);
+        cixel_s32 width = cixel->width_;
+        for(cixel_s32 i = 0; i < cixel->height_; ++i) {
+            const cixel_u32* src = pixels + (flipVertical ? (cixel->height_ - 1 - i) : i) * width;
+            if(!cixel->kernels_.mapColorRow_(table, indices + i * width, src, width)) {
+                return false;
             }
-        } // for(cixel_s32 j=width
+        }
+        cixel->size_ = table->size_;
+        for(cixel_s32 i = 0; i < table->size_; ++i) {
+            cixel_u32 rgba = table->colors_[i] | 0xFF000000U;
+            cixel->pallet_[i].color_ = rgba;
+            cixel->colors_[i].color_ = RGB2YUVFixed(rgba);
+        }
+        return true;
     }
 
-#else
     //-----------------------------------------------------------
-    CIXEL_STATIC void diffuseRight(Cixel* cixel, cixel_u8* CIXEL_RESTRICT indices, cixel_s32 width2, cixel_s32 y)
+    CIXEL_STATIC void diffuseRightScalar(const Cixel* cixel, cixel_u8* CIXEL_RESTRICT indices, const Color* CIXEL_RESTRICT yuv, ColorS16* CIXEL_RESTRICT current, ColorS16* CIXEL_RESTRICT next, cixel_s32 start, cixel_s32 end)
     {
-        cixel_s32 width = cixel->width_;
-
-        const Color* yuv = cixel->yuv_;
         const Color* colors = cixel->colors_;
         const cixel_s16* grid = cixel->grid_;
-        ColorS32* errors = cixel->errors_;
 
-        cixel_s32 index0 = y * width;
-        cixel_s32 index1 = y * width2 + 1;
-        for(cixel_s32 j = 0; j < width; ++j, ++index0, ++index1) {
+        cixel_s32 index1 = start + 1;
+        for(cixel_s32 index0 = start; index0 < end; ++index0, ++index1) {
             cixel_u8 r = yuv[index0].rgba_.r_;
             cixel_u8 g = yuv[index0].rgba_.g_;
             cixel_u8 b = yuv[index0].rgba_.b_;
             cixel_s32 sr = CIXEL_STATIC_CAST(cixel_s32)(r);
             cixel_s32 sg = CIXEL_STATIC_CAST(cixel_s32)(g);
             cixel_s32 sb = CIXEL_STATIC_CAST(cixel_s32)(b);
-            cixel_s32 ey = errors[index1].r_ + (sr << 4);
-            cixel_s32 eu = errors[index1].g_ + (sg << 4);
-            cixel_s32 ev = errors[index1].b_ + (sb << 4);
+            cixel_s32 ey = current[index1].r_ + (sr << 4);
+            cixel_s32 eu = current[index1].g_ + (sg << 4);
+            cixel_s32 ev = current[index1].b_ + (sb << 4);
             cixel_s32 ty = clamp(ey >> 4, 0, 255);
             cixel_s32 tu = clamp(eu >> 4, 0, 255);
             cixel_s32 tv = clamp(ev >> 4, 0, 255);
 
             cixel_s32 index = ((ty >> SHIFT_Y) << GRID_SHIFT_Y) + ((tu >> SHIFT_U) << GRID_SHIFT_U) + (tv >> SHIFT_V);
-            if(0 <= grid[index]) {
-                indices[index0] = CIXEL_STATIC_CAST(cixel_u8)(grid[index]);
-                ty = colors[indices[index0]].rgba_.r_;
-                tu = colors[indices[index0]].rgba_.g_;
-                tv = colors[indices[index0]].rgba_.b_;
-
-                cixel_s32 error[4];
-                error[0] = sr - ty;
-                error[1] = sg - tu;
-                error[2] = sb - tv;
-
-                muladdDiffusion(&errors[index1 - 1], K12YUV655, error);
-                muladdDiffusion(&errors[index1 + width2 - 1], K22YUV655, error);
-                muladdDiffusion(&errors[index1 + width2], K21YUV655, error);
-                muladdDiffusion(&errors[index1 + width2 + 1], K20YUV655, error);
-
-            } else {
-                sr >>= SHIFT_Y;
-                sg >>= SHIFT_U;
-                sb >>= SHIFT_V;
-                index = (sr << GRID_SHIFT_Y) + (sg << GRID_SHIFT_U) + sb;
-                indices[index0] = CIXEL_STATIC_CAST(cixel_u8)(grid[index]);
-                CIXEL_ASSERT(0 <= grid[index]);
-            }
-        } // for(cixel_s32 j=0
+            CIXEL_ASSERT(0 <= grid[index]);
+            indices[index0] = CIXEL_STATIC_CAST(cixel_u8)(grid[index]);
+            ty = colors[indices[index0]].rgba_.r_;
+            tu = colors[indices[index0]].rgba_.g_;
+            tv = colors[indices[index0]].rgba_.b_;
+
+            cixel_s32 error[4];
+            error[0] = sr - ty;
+            error[1] = sg - tu;
+            error[2] = sb - tv;
+
+            muladdDiffusion(&current[index1 - 1], K12YUV655, error);
+            muladdDiffusion(&next[index1 - 1], K22YUV655, error);
+            muladdDiffusion(&next[index1], K21YUV655, error);
+            muladdDiffusion(&next[index1 + 1], K20YUV655, error);
+        } // for(cixel_s32 index0
     }
 
     //-----------------------------------------------------------
-    CIXEL_STATIC void diffuseLeft(Cixel* cixel, cixel_u8* CIXEL_RESTRICT indices, cixel_s32 width2, cixel_s32 y)
+    CIXEL_STATIC void diffuseLeftScalar(const Cixel* cixel, cixel_u8* CIXEL_RESTRICT indices, const Color* CIXEL_RESTRICT yuv, ColorS16* CIXEL_RESTRICT current, ColorS16* CIXEL_RESTRICT next, cixel_s32 start, cixel_s32 end)
     {
-        cixel_s32 width = cixel->width_;
-
-        const Color* yuv = cixel->yuv_;
         const Color* colors = cixel->colors_;
         const cixel_s16* grid = cixel->grid_;
-        ColorS32* errors = cixel->errors_;
 
-        cixel_s32 index0 = y * width + width - 1;
-        cixel_s32 index1 = y * width2 + width;
-        for(cixel_s32 j = width; 1 <= j; --j, --index0, --index1) {
+        cixel_s32 index1 = end;
+        for(cixel_s32 index0 = end - 1; start <= index0; --index0, --index1) {
             cixel_u8 r = yuv[index0].rgba_.r_;
             cixel_u8 g = yuv[index0].rgba_.g_;
             cixel_u8 b = yuv[index0].rgba_.b_;
             cixel_s32 sr = CIXEL_STATIC_CAST(cixel_s32)(r);
             cixel_s32 sg = CIXEL_STATIC_CAST(cixel_s32)(g);
             cixel_s32 sb = CIXEL_STATIC_CAST(cixel_s32)(b);
-            cixel_s32 ey = errors[index1].r_ + (sr << 4);
-            cixel_s32 eu = errors[index1].g_ + (sg << 4);
-            cixel_s32 ev = errors[index1].b_ + (sb << 4);
+            cixel_s32 ey = current[index1].r_ + (sr << 4);
+            cixel_s32 eu = current[index1].g_ + (sg << 4);
+            cixel_s32 ev = current[index1].b_ + (sb << 4);
             cixel_s32 ty = clamp(ey >> 4, 0, 255);
             cixel_s32 tu = clamp(eu >> 4, 0, 255);
             cixel_s32 tv = clamp(ev >> 4, 0, 255);
 
             cixel_s32 index = ((ty >> SHIFT_Y) << GRID_SHIFT_Y) + ((tu >> SHIFT_U) << GRID_SHIFT_U) + (tv >> SHIFT_V);
-            if(0 <= grid[index]) {
-                indices[index0] = CIXEL_STATIC_CAST(cixel_u8)(grid[index]);
-                ty = colors[indices[index0]].rgba_.r_;
-                tu = colors[indices[index0]].rgba_.g_;
-                tv = colors[indices[index0]].rgba_.b_;
-                cixel_s32 error[4];
-                error[0] = sr - ty;
-                error[1] = sg - tu;
-                error[2] = sb - tv;
-
-                muladdDiffusion(&errors[index1 - 1], K12YUV655, error);
-                muladdDiffusion(&errors[index1 + width2 - 1], K20YUV655, error);
-                muladdDiffusion(&errors[index1 + width2], K21YUV655, error);
-                muladdDiffusion(&errors[index1 + width2 + 1], K22YUV655, error);
+            CIXEL_ASSERT(0 <= grid[index]);
+            indices[index0] = CIXEL_STATIC_CAST(cixel_u8)(grid[index]);
+            ty = colors[indices[index0]].rgba_.r_;
+            tu = colors[indices[index0]].rgba_.g_;
+            tv = colors[indices[index0]].rgba_.b_;
+            cixel_s32 error[4];
+            error[0] = sr - ty;
+            error[1] = sg - tu;
+            error[2] = sb - tv;
+
+            muladdDiffusion(&current[index1 - 1], K12YUV655, error);
+            muladdDiffusion(&next[index1 - 1], K20YUV655, error);
+            muladdDiffusion(&next[index1], K21YUV655, error);
+            muladdDiffusion(&next[index1 + 1], K22YUV655, error);
+        } // for(cixel_s32 index0
+    }
 
-            } else {
-                sr >>= SHIFT_Y;
-                sg >>= SHIFT_U;
-                sb >>= SHIFT_V;
-                index = (sr << GRID_SHIFT_Y) + (sg << GRID_SHIFT_U) + sb;
-                indices[index0] = CIXEL_STATIC_CAST(cixel_u8)(grid[index]);
-                CIXEL_ASSERT(0 <= grid[index]);
-            }
-        } // for(cixel_s32 j=width
+#if defined(CIXEL_X86)
+    //-----------------------------------------------------------
+    CIXEL_TARGET_SSE41 CIXEL_STATIC void diffuseRightSSE41(const Cixel* cixel, cixel_u8* CIXEL_RESTRICT indices, const Color* CIXEL_RESTRICT yuv, ColorS16* CIXEL_RESTRICT current, ColorS16* CIXEL_RESTRICT next, cixel_s32 start, cixel_s32 end)
+    {
+        const __m128i zero = _mm_setzero_si128();
+        const __m128i c255 = _mm_set1_epi32(255);
+        const __m128i cK12YUV655 = _mm_set1_epi32(K12YUV655);
+        const __m128i cK20YUV655 = _mm_set1_epi32(K20YUV655);
+        const __m128i cK21YUV655 = _mm_set1_epi32(K21YUV655);
+        const __m128i cK22YUV655 = _mm_set1_epi32(K22YUV655);
+
+        const Color* colors = cixel->colors_;
+        const cixel_s16* grid = cixel->grid_;
+
+        CIXEL_ALIGN(16) cixel_s32 tmp[4];
+
+        cixel_s32 index1 = start + 1;
+        for(cixel_s32 index0 = start; index0 < end; ++index0, ++index1) {
+            __m128i i0 = _mm_cvtsi32_si128(*((cixel_s32*)&yuv[index0]));
+            i0 = _mm_unpacklo_epi8(i0, zero);
+            i0 = _mm_unpacklo_epi16(i0, zero);
+
+            __m128i error = loadErrorSSE41(&current[index1]);
+            error = _mm_add_epi32(error, _mm_slli_epi32(i0, 4));
+            error = _mm_srai_epi32(error, 4);
+            error = _mm_max_epi32(error, zero);
+            error = _mm_min_epi32(error, c255);
+            _mm_store_si128((__m128i*)tmp, error);
+
+            cixel_s32 index = ((tmp[0] >> SHIFT_Y) << GRID_SHIFT_Y) + ((tmp[1] >> SHIFT_U) << GRID_SHIFT_U) + (tmp[2] >> SHIFT_V);
+            CIXEL_ASSERT(0 <= grid[index]);
+            indices[index0] = CIXEL_STATIC_CAST(cixel_u8)(grid[index]);
+
+            __m128i t0 = _mm_cvtsi32_si128(*((cixel_s32*)&colors[indices[index0]]));
+            t0 = _mm_unpacklo_epi8(t0, zero);
+            t0 = _mm_unpacklo_epi16(t0, zero);
+
+            error = _mm_sub_epi32(i0, t0);
+
+            muladdDiffusionSSE41(&current[index1 - 1], cK12YUV655, error);
+            muladdDiffusionSSE41(&next[index1 - 1], cK22YUV655, error);
+            muladdDiffusionSSE41(&next[index1], cK21YUV655, error);
+            muladdDiffusionSSE41(&next[index1 + 1], cK20YUV655, error);
+        } // for(cixel_s32 index0
+    }
+
+    //-----------------------------------------------------------
+    CIXEL_TARGET_SSE41 CIXEL_STATIC void diffuseLeftSSE41(const Cixel* cixel, cixel_u8* CIXEL_RESTRICT indices, const Color* CIXEL_RESTRICT yuv, ColorS16* CIXEL_RESTRICT current, ColorS16* CIXEL_RESTRICT next, cixel_s32 start, cixel_s32 end)
+    {
+        const __m128i zero = _mm_setzero_si128();
+        const __m128i c255 = _mm_set1_epi32(255);
+        const __m128i cK12YUV655 = _mm_set1_epi32(K12YUV655);
+        const __m128i cK20YUV655 = _mm_set1_epi32(K20YUV655);
+        const __m128i cK21YUV655 = _mm_set1_epi32(K21YUV655);
+        const __m128i cK22YUV655 = _mm_set1_epi32(K22YUV655);
+
+        const Color* colors = cixel->colors_;
+        const cixel_s16* grid = cixel->grid_;
+
+        CIXEL_ALIGN(16) cixel_s32 tmp[4];
+
+        cixel_s32 index1 = end;
+        for(cixel_s32 index0 = end - 1; start <= index0; --index0, --index1) {
+            __m128i i0 = _mm_cvtsi32_si128(*((cixel_s32*)&yuv[index0]));
+            i0 = _mm_unpacklo_epi8(i0, zero);
+            i0 = _mm_unpacklo_epi16(i0, zero);
+
+            __m128i error = loadErrorSSE41(&current[index1]);
+            error = _mm_add_epi32(error, _mm_slli_epi32(i0, 4));
+            error = _mm_srai_epi32(error, 4);
+            error = _mm_max_epi32(error, zero);
+            error = _mm_min_epi32(error, c255);
+            _mm_store_si128((__m128i*)tmp, error);
+
+            cixel_s32 index = ((tmp[0] >> SHIFT_Y) << GRID_SHIFT_Y) + ((tmp[1] >> SHIFT_U) << GRID_SHIFT_U) + (tmp[2] >> SHIFT_V);
+            CIXEL_ASSERT(0 <= grid[index]);
+            indices[index0] = CIXEL_STATIC_CAST(cixel_u8)(grid[index]);
+
+            __m128i t0 = _mm_cvtsi32_si128(*((cixel_s32*)&colors[indices[index0]]));
+            t0 = _mm_unpacklo_epi8(t0, zero);
+            t0 = _mm_unpacklo_epi16(t0, zero);
+
+            error = _mm_sub_epi32(i0, t0);
+
+            muladdDiffusionSSE41(&current[index1 - 1], cK12YUV655, error);
+            muladdDiffusionSSE41(&next[index1 - 1], cK20YUV655, error);
+            muladdDiffusionSSE41(&next[index1], cK21YUV655, error);
+            muladdDiffusionSSE41(&next[index1 + 1], cK22YUV655, error);
+        } // for(cixel_s32 index0
     }
+
 #endif
 
+    CIXEL_STATIC void diffuseRow(const Cixel* cixel, cixel_u8* CIXEL_RESTRICT indices, cixel_s32 y, ColorS16* current, ColorS16* next)
+    {
+        const Color* yuv = cixel->yuv_ + y * cixel->width_;
+        if(Dither_FloydSteinbergRaster == cixel->dither_ || 0 == (y & 0x01U)) {
+            cixel->kernels_.diffuseRight_(cixel, indices, yuv, current, next, 0, cixel->width_);
+        } else {
+            cixel->kernels_.diffuseLeft_(cixel, indices, yuv, current, next, 0, cixel->width_);
+        }
+    }
+
+    /**
+    @brief Diffuse rows from zero errors with two rows of errors, indices of rows before rowStart are discarded
+    @param [in] first ... the first row to diffuse
+    @param [in] rowStart ... the first row to write indices
+    @param [in] rowEnd ... the end of rows
+    */
+    CIXEL_STATIC void diffuseRows(const Cixel* cixel, cixel_u8* CIXEL_RESTRICT indices, const Strip* strip, cixel_s32 first, cixel_s32 rowStart, cixel_s32 rowEnd)
+    {
+        cixel_s32 width = cixel->width_;
+        cixel_s32 width2 = width + 2;
+        ColorS16* current = strip->errors_;
+        ColorS16* next = strip->errors_ + width2;
+        memset(strip->errors_, 0, sizeof(ColorS16) * width2 * 2);
+        for(cixel_s32 i = first; i < rowEnd; ++i) {
+            cixel_u8* row = (i < rowStart) ? strip->indices_ : indices + i * width;
+            diffuseRow(cixel, row, i, current, next);
+            ColorS16* tmp = current;
+            current = next;
+            next = tmp;
+            memset(next, 0, sizeof(ColorS16) * width2);
+        }
+    }
+
     CIXEL_STATIC void errorDiffusion(Cixel* cixel, cixel_u8* CIXEL_RESTRICT indices)
     {
         CIXEL_ASSERT(CIXEL_NULL != indices);
-        cixel_s32 width2 = cixel->width_ + 2;
-        cixel_s32 size = width2 * (cixel->height_ + 1);
+        diffuseRows(cixel, indices, &cixel->strip_, 0, 0, cixel->height_);
+    }
 
-#if defined(CIXEL_SSE)
-        setZero16(cixel->errors_, sizeof(ColorS32) * size);
-        __m128i zero = _mm_setzero_si128();
-        __m128i c255 = _mm_set1_epi32(255);
+    /**
+    @brief Diffuse a strip of rows from zero errors, starting some rows above it
+    */
+    CIXEL_STATIC void diffuseStrip(const Cixel* cixel, cixel_u8* CIXEL_RESTRICT indices, const Strip* strip, cixel_s32 index)
+    {
+        cixel_s32 rowStart = index * STRIP_HEIGHT;
+        cixel_s32 rowEnd = minimum(rowStart + STRIP_HEIGHT, cixel->height_);
+        diffuseRows(cixel, indices, strip, maximum(rowStart - STRIP_OVERLAP, 0), rowStart, rowEnd);
+    }
 
-        __m128i cK12YUV655 = _mm_set1_epi32(K12YUV655);
-        __m128i cK20YUV655 = _mm_set1_epi32(K20YUV655);
-        __m128i cK21YUV655 = _mm_set1_epi32(K21YUV655);
-        __m128i cK22YUV655 = _mm_set1_epi32(K22YUV655);
+    struct WavefrontJob_t
+    {
+        Cixel* cixel_;
+        cixel_u8* indices_;
+        cixel_s32 numRows_; //< rows in the ring of errors
+        cixel_s32 nextRow_;
+    };
 
-        for(cixel_s32 i = 0; i < cixel->height_; ++i) {
-            if(0 == (i & 0x01U)) {
-                diffuseRight(cixel, indices, width2, i,
-                    &zero, &c255, &cK12YUV655, &cK20YUV655, &cK21YUV655, &cK22YUV655);
-            } else {
-                diffuseLeft(cixel, indices, width2, i,
-                    &zero, &c255, &cK12YUV655, &cK20YUV655, &cK21YUV655, &cK22YUV655);
+    typedef struct WavefrontJob_t WavefrontJob;
+
+    /**
+    @brief Diffuse rows in raster order, each row trails the row above
+
+    Pixel x of a row takes errors from pixels up to x+1 of the row above, so it waits until the row above has diffused x+2 pixels.
+    Rows are taken in order from a shared counter, so the row above is always owned by a running job, and jobs never wait for jobs which have not started.
+    Rows finish in order and at most one row per job is running, so a ring of one more row than jobs is enough for errors.
+    */
+    CIXEL_STATIC void wavefrontJob(void* args, cixel_s32 index)
+    {
+        (void)index;
+        WavefrontJob* job = CIXEL_REINTERPRET_CAST(WavefrontJob*)(args);
+        Cixel* cixel = job->cixel_;
+        cixel_s32 width = cixel->width_;
+        cixel_s32 width2 = width + 2;
+        const Color* yuv = cixel->yuv_;
+        cixel_s32* progress = cixel->progress_;
+        for(;;) {
+            cixel_s32 y = CIXEL_ATOMIC_FETCH_ADD(&job->nextRow_, 1);
+            if(cixel->height_ <= y) {
+                break;
+            }
+            ColorS16* current = cixel->ring_ + (y % job->numRows_) * width2;
+            ColorS16* next = cixel->ring_ + ((y + 1) % job->numRows_) * width2;
+            memset(next, 0, sizeof(ColorS16) * width2);
+            for(cixel_s32 start = 0; start < width;) {
+                cixel_s32 end = minimum(start + WAVEFRONT_CHUNK, width);
+                if(0 < y) {
+                    cixel_s32 required = minimum(end + 1, width);
+                    while(CIXEL_ATOMIC_LOAD(&progress[y - 1]) < required) {
+                        CIXEL_PAUSE();
+                    }
+                }
+                cixel->kernels_.diffuseRight_(cixel, job->indices_ + y * width, yuv + y * width, current, next, start, end);
+                CIXEL_ATOMIC_STORE(&progress[y], end);
+                start = end;
             }
         }
-#else
-        memset(cixel->errors_, 0, sizeof(ColorS32) * size);
+    }
 
-        for(cixel_s32 i = 0; i < cixel->height_; ++i) {
-            if(0 == (i & 0x01U)) {
-                diffuseRight(cixel, indices, width2, i);
+    //--- Ordered dithering
+    static const cixel_u8 Bayer8x8[64] = {
+        0, 32, 8, 40, 2, 34, 10, 42,
+        48, 16, 56, 24, 50, 18, 58, 26,
+        12, 44, 4, 36, 14, 46, 6, 38,
+        60, 28, 52, 20, 62, 30, 54, 22,
+        3, 35, 11, 43, 1, 33, 9, 41,
+        51, 19, 59, 27, 49, 17, 57, 25,
+        15, 47, 7, 39, 13, 45, 5, 37,
+        63, 31, 55, 23, 61, 29, 53, 21,
+    };
+
+    CIXEL_STATIC void orderedDither(Cixel* cixel, cixel_u8* CIXEL_RESTRICT indices, cixel_s32 rowStart, cixel_s32 rowEnd)
+    {
+        cixel_s32 width = cixel->width_;
+        const Color* yuv = cixel->yuv_;
+        const cixel_s16* grid = cixel->grid_;
+        for(cixel_s32 i = rowStart; i < rowEnd; ++i) {
+            const cixel_u8* thresholds = Bayer8x8 + ((i & 7) << 3);
+            cixel_s32 index0 = i * width;
+            for(cixel_s32 j = 0; j < width; ++j, ++index0) {
+                // Offsets in [-8, 8), which spans two cells of the grid
+                cixel_s32 offset = (CIXEL_STATIC_CAST(cixel_s32)(thresholds[j & 7]) - 32) >> 2;
+                cixel_s32 ty = clamp(yuv[index0].rgba_.r_ + offset, 0, 255);
+                cixel_s32 tu = clamp(yuv[index0].rgba_.g_ + offset, 0, 255);
+                cixel_s32 tv = clamp(yuv[index0].rgba_.b_ + offset, 0, 255);
+                cixel_s32 index = ((ty >> SHIFT_Y) << GRID_SHIFT_Y) + ((tu >> SHIFT_U) << GRID_SHIFT_U) + (tv >> SHIFT_V);
+                CIXEL_ASSERT(0 <= grid[index]);
+                indices[index0] = CIXEL_STATIC_CAST(cixel_u8)(grid[index]);
+            }
+        }
+    }
+
+    struct DitherJob_t
+    {
+        Cixel* cixel_;
+        cixel_u8* indices_;
+        cixel_s32 numJobs_;
+    };
+
+    typedef struct DitherJob_t DitherJob;
+
+    CIXEL_STATIC void orderedDitherJob(void* args, cixel_s32 index)
+    {
+        DitherJob* job = CIXEL_REINTERPRET_CAST(DitherJob*)(args);
+        Cixel* cixel = job->cixel_;
+        cixel_s32 rowStart = CIXEL_STATIC_CAST(cixel_s32)(CIXEL_STATIC_CAST(cixel_s64)(cixel->height_) * index / job->numJobs_);
+        cixel_s32 rowEnd = CIXEL_STATIC_CAST(cixel_s32)(CIXEL_STATIC_CAST(cixel_s64)(cixel->height_) * (index + 1) / job->numJobs_);
+        orderedDither(cixel, job->indices_, rowStart, rowEnd);
+    }
+
+    CIXEL_STATIC void stripJob(void* args, cixel_s32 index)
+    {
+        DitherJob* job = CIXEL_REINTERPRET_CAST(DitherJob*)(args);
+        Cixel* cixel = job->cixel_;
+        const Strip* strip = (0 == index) ? &cixel->strip_ : &cixel->strips_[index - 1];
+        cixel_s32 numStrips = (cixel->height_ + STRIP_HEIGHT - 1) / STRIP_HEIGHT;
+        for(cixel_s32 i = index; i < numStrips; i += job->numJobs_) {
+            diffuseStrip(cixel, job->indices_, strip, i);
+        }
+    }
+
+    CIXEL_STATIC void dither(Cixel* cixel, cixel_u8* CIXEL_RESTRICT indices)
+    {
+        cixel_s32 numJobs = minimum(cixel->numThreads_, cixel->height_);
+        if(Dither_FloydSteinbergRaster == cixel->dither_ && 1 < numJobs) {
+            memset(cixel->ring_, 0, sizeof(ColorS16) * (cixel->width_ + 2));
+            memset(cixel->progress_, 0, sizeof(cixel_s32) * cixel->height_);
+            WavefrontJob job;
+            job.cixel_ = cixel;
+            job.indices_ = indices;
+            job.numRows_ = numJobs + 1;
+            job.nextRow_ = 0;
+            cixel->parallelFunc_(wavefrontJob, &job, numJobs, cixel->parallelUserData_);
+            return;
+        }
+        if(Dither_FloydSteinbergStrips == cixel->dither_) {
+            // Strips do not depend on the number of jobs, so neither does the result
+            cixel_s32 numStrips = (cixel->height_ + STRIP_HEIGHT - 1) / STRIP_HEIGHT;
+            numJobs = minimum(numJobs, numStrips);
+            if(1 < numJobs) {
+                DitherJob job;
+                job.cixel_ = cixel;
+                job.indices_ = indices;
+                job.numJobs_ = numJobs;
+                cixel->parallelFunc_(stripJob, &job, numJobs, cixel->parallelUserData_);
             } else {
-                diffuseLeft(cixel, indices, width2, i);
+                for(cixel_s32 i = 0; i < numStrips; ++i) {
+                    diffuseStrip(cixel, indices, &cixel->strip_, i);
+                }
             }
+            return;
+        }
+        if(Dither_Ordered != cixel->dither_) {
+            errorDiffusion(cixel, indices);
+            return;
+        }
+        if(1 < numJobs) {
+            DitherJob job;
+            job.cixel_ = cixel;
+            job.indices_ = indices;
+            job.numJobs_ = numJobs;
+            cixel->parallelFunc_(orderedDitherJob, &job, numJobs, cixel->parallelUserData_);
+        } else {
+            orderedDither(cixel, indices, 0, cixel->height_);
         }
-#endif
     }
 
-    CIXEL_STATIC cixel_s32 writeNumber(cixel_s32 pos, cixel_u8* str, cixel_s32 number)
+    CIXEL_STATIC cixel_s32 countDigits(cixel_u32 number)
     {
-        CIXEL_ASSERT(0 <= number && number < 1000);
-        if(100 <= number) {
-            cixel_s32 hundreds = number / 100;
-            number -= 100 * hundreds;
-            cixel_s32 tens = number / 10;
-            number -= 10 * tens;
-            cixel_s32 ones = number;
-            str[pos + 0] = CIXEL_STATIC_CAST(cixel_u8)(hundreds + '0');
-            str[pos + 1] = CIXEL_STATIC_CAST(cixel_u8)(tens + '0');
-            str[pos + 2] = CIXEL_STATIC_CAST(cixel_u8)(ones + '0');
-            return pos + 3;
-
-        } else if(10 <= number) {
-            cixel_s32 tens = number / 10;
-            number -= 10 * tens;
-            cixel_s32 ones = number;
-            str[pos + 0] = CIXEL_STATIC_CAST(cixel_u8)(tens + '0');
-            str[pos + 1] = CIXEL_STATIC_CAST(cixel_u8)(ones + '0');
-            return pos + 2;
+        cixel_s32 count = 1;
+        for(; 10000U <= number; number /= 10000U) {
+            count += 4;
+        }
+        return count + ((10U <= number) ? 1 : 0) + ((100U <= number) ? 1 : 0) + ((1000U <= number) ? 1 : 0);
+    }
 
+    /**
+    @brief Write a number of any digits, two digits at once from the last
+    */
+    CIXEL_STATIC cixel_s32 writeNumber(cixel_s32 pos, cixel_u8* str, cixel_s32 number)
+    {
+        CIXEL_ASSERT(0 <= number);
+        cixel_u32 n = CIXEL_STATIC_CAST(cixel_u32)(number);
+        cixel_s32 end = pos + countDigits(n);
+        cixel_s32 i = end;
+        for(; 100U <= n; n /= 100U) {
+            cixel_u32 pair = (n % 100U) * 2;
+            i -= 2;
+            str[i + 0] = CIXEL_STATIC_CAST(cixel_u8)(digitPairs[pair + 0]);
+            str[i + 1] = CIXEL_STATIC_CAST(cixel_u8)(digitPairs[pair + 1]);
+        }
+        if(10U <= n) {
+            str[i - 2] = CIXEL_STATIC_CAST(cixel_u8)(digitPairs[n * 2 + 0]);
+            str[i - 1] = CIXEL_STATIC_CAST(cixel_u8)(digitPairs[n * 2 + 1]);
         } else {
-            str[pos + 0] = CIXEL_STATIC_CAST(cixel_u8)(number + '0');
-            return pos + 1;
+            str[i - 1] = CIXEL_STATIC_CAST(cixel_u8)(n + '0');
         }
+        return end;
     }
 
     CIXEL_STATIC cixel_s32 cixelWrite(cixel_s32 pos, cixel_u8* str, cixel_s32 n, const char* data)
@@ -1558,9 +2908,12 @@ CIXEL_NAMESPACE_EMPTY_BEGIN
         return pos;
     }
 
+    /**
+    @brief Write a run of sixels, a repeat of any length takes two bytes and digits, which are no more than the run
+    */
     CIXEL_STATIC cixel_s32 writeBits(cixel_s32 pos, cixel_u8* str, cixel_s32 run, cixel_u8 bits)
     {
-        CIXEL_ASSERT(0 < run && run <= 255);
+        CIXEL_ASSERT(0 < run);
         CIXEL_ASSERT(bits <= 63);
         bits += 63;
         if(3 < run) {
@@ -1578,6 +2931,153 @@ CIXEL_NAMESPACE_EMPTY_BEGIN
         }
     }
 
+    /**
+    @brief Find the end of the run which begins at start
+    @return the first position in (start, end) whose value differs from bits[start], or end
+    */
+    CIXEL_STATIC cixel_s32 findRunEndScalar(const cixel_u8* CIXEL_RESTRICT bits, cixel_s32 start, cixel_s32 end)
+    {
+        cixel_u8 value = bits[start];
+        cixel_s32 i = start + 1;
+        for(; i < end; ++i) {
+            if(value != bits[i]) {
+                break;
+            }
+        }
+        return i;
+    }
+
+#if defined(CIXEL_X86)
+    CIXEL_TARGET_SSE41 CIXEL_STATIC cixel_s32 findRunEndSSE41(const cixel_u8* CIXEL_RESTRICT bits, cixel_s32 start, cixel_s32 end)
+    {
+        const __m128i value = _mm_set1_epi8(CIXEL_STATIC_CAST(char)(bits[start]));
+        cixel_s32 i = start + 1;
+        for(; (i + 16) <= end; i += 16) {
+            __m128i x = _mm_loadu_si128(CIXEL_REINTERPRET_CAST(const __m128i*)(bits + i));
+            cixel_u32 mask = CIXEL_STATIC_CAST(cixel_u32)(_mm_movemask_epi8(_mm_cmpeq_epi8(x, value))) ^ 0xFFFFU;
+            if(0 != mask) {
+                return i + countTrailingZeros(mask);
+            }
+        }
+        return findRunEndScalar(bits, i - 1, end);
+    }
+
+    CIXEL_TARGET_AVX2 CIXEL_STATIC cixel_s32 findRunEndAVX2(const cixel_u8* CIXEL_RESTRICT bits, cixel_s32 start, cixel_s32 end)
+    {
+        const __m256i value = _mm256_set1_epi8(CIXEL_STATIC_CAST(char)(bits[start]));
+        cixel_s32 i = start + 1;
+        for(; (i + 32) <= end; i += 32) {
+            __m256i x = _mm256_loadu_si256(CIXEL_REINTERPRET_CAST(const __m256i*)(bits + i));
+            cixel_u32 mask = ~CIXEL_STATIC_CAST(cixel_u32)(_mm256_movemask_epi8(_mm256_cmpeq_epi8(x, value)));
+            if(0 != mask) {
+                return i + countTrailingZeros(mask);
+            }
+        }
+        return findRunEndScalar(bits, i - 1, end);
+    }
+#endif
+
+    /**
+    @brief Build sixels of a color from rows of indices of a band
+    @param [out] sixels ... six bits of the color at each column in [start, end)
+    @param [in] indices ... the first row of the band
+    @param [in] rows ... number of rows of the band
+    */
+    CIXEL_STATIC void buildSixelsScalar(cixel_u8* CIXEL_RESTRICT sixels, const cixel_u8* CIXEL_RESTRICT indices, cixel_s32 width, cixel_s32 rows, cixel_u8 color, cixel_s32 start, cixel_s32 end)
+    {
+        for(cixel_s32 k = start; k < end; ++k) {
+            cixel_u8 bits = 0;
+            for(cixel_s32 j = 0; j < rows; ++j) {
+                bits |= CIXEL_STATIC_CAST(cixel_u8)((color == indices[width * j + k]) << j);
+            }
+            sixels[k] = bits;
+        }
+    }
+
+#if defined(CIXEL_X86)
+    CIXEL_TARGET_SSE41 CIXEL_STATIC void buildSixelsSSE41(cixel_u8* CIXEL_RESTRICT sixels, const cixel_u8* CIXEL_RESTRICT indices, cixel_s32 width, cixel_s32 rows, cixel_u8 color, cixel_s32 start, cixel_s32 end)
+    {
+        const __m128i value = _mm_set1_epi8(CIXEL_STATIC_CAST(char)(color));
+        cixel_s32 k = start;
+        if(6 == rows) {
+            // Bits are accumulated from the bottom row, each row doubles the sum and subtracts a mask of -1
+            for(; (k + 16) <= end; k += 16) {
+                const cixel_u8* column = indices + k;
+                __m128i bits = _mm_sub_epi8(_mm_setzero_si128(), _mm_cmpeq_epi8(_mm_loadu_si128(CIXEL_REINTERPRET_CAST(const __m128i*)(column + width * 5)), value));
+                bits = _mm_sub_epi8(_mm_add_epi8(bits, bits), _mm_cmpeq_epi8(_mm_loadu_si128(CIXEL_REINTERPRET_CAST(const __m128i*)(column + width * 4)), value));
+                bits = _mm_sub_epi8(_mm_add_epi8(bits, bits), _mm_cmpeq_epi8(_mm_loadu_si128(CIXEL_REINTERPRET_CAST(const __m128i*)(column + width * 3)), value));
+                bits = _mm_sub_epi8(_mm_add_epi8(bits, bits), _mm_cmpeq_epi8(_mm_loadu_si128(CIXEL_REINTERPRET_CAST(const __m128i*)(column + width * 2)), value));
+                bits = _mm_sub_epi8(_mm_add_epi8(bits, bits), _mm_cmpeq_epi8(_mm_loadu_si128(CIXEL_REINTERPRET_CAST(const __m128i*)(column + width * 1)), value));
+                bits = _mm_sub_epi8(_mm_add_epi8(bits, bits), _mm_cmpeq_epi8(_mm_loadu_si128(CIXEL_REINTERPRET_CAST(const __m128i*)(column)), value));
+                _mm_storeu_si128(CIXEL_REINTERPRET_CAST(__m128i*)(sixels + k), bits);
+            }
+        }
+        buildSixelsScalar(sixels, indices, width, rows, color, k, end);
+    }
+
+    CIXEL_TARGET_AVX2 CIXEL_STATIC void buildSixelsAVX2(cixel_u8* CIXEL_RESTRICT sixels, const cixel_u8* CIXEL_RESTRICT indices, cixel_s32 width, cixel_s32 rows, cixel_u8 color, cixel_s32 start, cixel_s32 end)
+    {
+        const __m256i value = _mm256_set1_epi8(CIXEL_STATIC_CAST(char)(color));
+        cixel_s32 k = start;
+        if(6 == rows) {
+            for(; (k + 32) <= end; k += 32) {
+                const cixel_u8* column = indices + k;
+                __m256i bits = _mm256_sub_epi8(_mm256_setzero_si256(), _mm256_cmpeq_epi8(_mm256_loadu_si256(CIXEL_REINTERPRET_CAST(const __m256i*)(column + width * 5)), value));
+                bits = _mm256_sub_epi8(_mm256_add_epi8(bits, bits), _mm256_cmpeq_epi8(_mm256_loadu_si256(CIXEL_REINTERPRET_CAST(const __m256i*)(column + width * 4)), value));
+                bits = _mm256_sub_epi8(_mm256_add_epi8(bits, bits), _mm256_cmpeq_epi8(_mm256_loadu_si256(CIXEL_REINTERPRET_CAST(const __m256i*)(column + width * 3)), value));
+                bits = _mm256_sub_epi8(_mm256_add_epi8(bits, bits), _mm256_cmpeq_epi8(_mm256_loadu_si256(CIXEL_REINTERPRET_CAST(const __m256i*)(column + width * 2)), value));
+                bits = _mm256_sub_epi8(_mm256_add_epi8(bits, bits), _mm256_cmpeq_epi8(_mm256_loadu_si256(CIXEL_REINTERPRET_CAST(const __m256i*)(column + width * 1)), value));
+                bits = _mm256_sub_epi8(_mm256_add_epi8(bits, bits), _mm256_cmpeq_epi8(_mm256_loadu_si256(CIXEL_REINTERPRET_CAST(const __m256i*)(column)), value));
+                _mm256_storeu_si256(CIXEL_REINTERPRET_CAST(__m256i*)(sixels + k), bits);
+            }
+        }
+        buildSixelsSSE41(sixels, indices, width, rows, color, k, end);
+    }
+#endif
+
+    CIXEL_STATIC void selectKernels(Kernels* kernels, SIMD simd)
+    {
+        kernels->rgb2yuvRow_ = rgb2yuvRowScalar;
+        kernels->accumulateRow_ = accumulateRowScalar;
+        kernels->diffuseRight_ = diffuseRightScalar;
+        kernels->diffuseLeft_ = diffuseLeftScalar;
+        kernels->findRunEnd_ = findRunEndScalar;
+        kernels->buildSixels_ = buildSixelsScalar;
+        kernels->addRow_ = addRowScalar;
+        kernels->mapColorRow_ = mapColorRowScalar;
+        kernels->findNearest_ = findNearestScalar;
+#if defined(CIXEL_X86)
+        switch(simd) {
+        case SIMD_AVX2:
+            kernels->rgb2yuvRow_ = rgb2yuvRowAVX2;
+            kernels->accumulateRow_ = accumulateRowAVX2;
+            kernels->diffuseRight_ = diffuseRightSSE41;
+            kernels->diffuseLeft_ = diffuseLeftSSE41;
+            kernels->findRunEnd_ = findRunEndAVX2;
+            kernels->buildSixels_ = buildSixelsAVX2;
+            kernels->addRow_ = addRowAVX2;
+            kernels->mapColorRow_ = mapColorRowSSE41;
+            kernels->findNearest_ = findNearestAVX2;
+            break;
+        case SIMD_SSE41:
+            kernels->rgb2yuvRow_ = rgb2yuvRowSSE41;
+            kernels->accumulateRow_ = accumulateRowSSE41;
+            kernels->diffuseRight_ = diffuseRightSSE41;
+            kernels->diffuseLeft_ = diffuseLeftSSE41;
+            kernels->findRunEnd_ = findRunEndSSE41;
+            kernels->buildSixels_ = buildSixelsSSE41;
+            kernels->addRow_ = addRowSSE41;
+            kernels->mapColorRow_ = mapColorRowSSE41;
+            kernels->findNearest_ = findNearestSSE41;
+            break;
+        default:
+            break;
+        }
+#else
+        (void)simd;
+#endif
+    }
+
     CIXEL_STATIC cixel_s32 writePalletColor(cixel_s32 pos, cixel_u8* str, cixel_s32 index, cixel_s32 r, cixel_s32 g, cixel_s32 b)
     {
         pos = put(pos, str, '#');
@@ -1591,9 +3091,313 @@ CIXEL_NAMESPACE_EMPTY_BEGIN
         return pos;
     }
 
+    /**
+    @brief A pass of a color takes at most one byte per column besides PASS_RESERVE, so the buffer does not depend on the height
+    */
+    CIXEL_STATIC cixel_s32 getWriteBufferSize(cixel_s32 width)
+    {
+        return maximum(WRITE_BUFFER_SIZE, width + PASS_RESERVE);
+    }
+
+    /**
+    @brief Every color of a band takes a pass, a band has at most six colors per column
+    */
+    CIXEL_STATIC cixel_s32 getBandBufferSize(cixel_s32 width)
+    {
+        return minimum(MAX_COLORS, width * 6) * (width + PASS_RESERVE) + PASS_RESERVE;
+    }
+
+    CIXEL_STATIC void writeFile(const void* data, cixel_size_t size, void* userData)
+    {
+        fwrite(data, size, 1, CIXEL_STATIC_CAST(FILE*)(userData));
+    }
+
+    CIXEL_STATIC void initWriter(Writer* writer, const CixelEncoder* encoder, WriteFunc writeFunc, void* userData, cixel_u8* destination, cixel_size_t destinationSize)
+    {
+        writer->buffer_ = encoder->writeBuffer_;
+        writer->capacity_ = encoder->writeBufferSize_;
+        writer->staging_ = encoder->writeBuffer_;
+        writer->stagingSize_ = encoder->writeBufferSize_;
+        writer->writeFunc_ = writeFunc;
+        writer->userData_ = userData;
+        writer->destination_ = destination;
+        writer->destinationSize_ = destinationSize;
+        writer->total_ = 0;
+    }
+
+    /**
+    @brief Write out pos bytes, then point the buffer where size more bytes fit
+    */
+    CIXEL_STATIC void flush(Writer* writer, cixel_s32 pos, cixel_s32 size)
+    {
+        CIXEL_ASSERT(size <= writer->stagingSize_);
+        if(CIXEL_NULL != writer->writeFunc_) {
+            if(0 < pos) {
+                writer->writeFunc_(writer->buffer_, pos, writer->userData_);
+            }
+            writer->total_ += pos;
+            return;
+        }
+        // Bytes in the internal buffer are copied as many as the destination can take
+        cixel_size_t rest = (writer->total_ < writer->destinationSize_) ? writer->destinationSize_ - writer->total_ : 0;
+        if(writer->buffer_ == writer->staging_) {
+            cixel_size_t count = minimum(CIXEL_STATIC_CAST(cixel_size_t)(pos), rest);
+            if(0 < count) {
+                memcpy(writer->destination_ + writer->total_, writer->staging_, count);
+            }
+        }
+        writer->total_ += pos;
+        rest = (writer->total_ < writer->destinationSize_) ? writer->destinationSize_ - writer->total_ : 0;
+        if(CIXEL_STATIC_CAST(cixel_size_t)(size) <= rest) {
+            writer->buffer_ = writer->destination_ + writer->total_;
+            writer->capacity_ = (rest < 0x40000000U) ? CIXEL_STATIC_CAST(cixel_s32)(rest) : 0x40000000; // positions never overflow
+        } else {
+            writer->buffer_ = writer->staging_;
+            writer->capacity_ = writer->stagingSize_;
+        }
+    }
+
+    /**
+    @brief Write out the buffer, if it cannot take size more bytes
+    @return position to write next
+    */
+    CIXEL_STATIC cixel_s32 reserve(Writer* writer, cixel_s32 pos, cixel_s32 size)
+    {
+        if(writer->capacity_ < (pos + size)) {
+            flush(writer, pos, size);
+            return 0;
+        }
+        return pos;
+    }
+
+    /**
+    @brief Write bytes which are already encoded, a callback receives them without a copy
+    @return position to write next
+    */
+    CIXEL_STATIC cixel_s32 append(Writer* writer, cixel_s32 pos, const cixel_u8* data, cixel_s32 size)
+    {
+        if(CIXEL_NULL != writer->writeFunc_) {
+            flush(writer, pos, 0);
+            if(0 < size) {
+                writer->writeFunc_(data, size, writer->userData_);
+            }
+            writer->total_ += size;
+            return 0;
+        }
+        while(0 < size) {
+            pos = reserve(writer, pos, minimum(size, writer->stagingSize_));
+            cixel_s32 count = minimum(size, writer->capacity_ - pos);
+            memcpy(writer->buffer_ + pos, data, count);
+            pos += count;
+            data += count;
+            size -= count;
+        }
+        return pos;
+    }
+
+    /**
+    @brief Size of buffers of an encoder, a pass of a color is written out whenever the buffer is full
+    */
+    CIXEL_STATIC cixel_size_t getEncoderWorkSize(cixel_s32 width)
+    {
+        cixel_size_t writeBufferSize = align(getWriteBufferSize(width));
+        cixel_size_t sixelsSize = align(sizeof(cixel_u8) * width);
+        cixel_size_t colorUsedSize = align(MAX_COLORS);
+        cixel_size_t spansSize = align(sizeof(cixel_s32) * MAX_COLORS * 6) * 2;
+        return writeBufferSize + sixelsSize + colorUsedSize + spansSize;
+    }
+
+    /**
+    @brief Point buffers of an encoder into its work, which keeps work of threads
+    */
+    CIXEL_STATIC void placeEncoder(CixelEncoder* encoder, cixel_u8* work, cixel_s32 width, cixel_s32 height)
+    {
+        cixel_size_t writeBufferSize = align(getWriteBufferSize(width));
+        cixel_size_t sixelsSize = align(sizeof(cixel_u8) * width);
+        cixel_size_t colorUsedSize = align(MAX_COLORS);
+
+        encoder->width_ = width;
+        encoder->height_ = height;
+        encoder->writeBuffer_ = work;
+        encoder->writeBufferSize_ = getWriteBufferSize(width);
+        encoder->band_.sixels_ = work + writeBufferSize;
+        encoder->band_.colorFlags_ = CIXEL_REINTERPRET_CAST(cixel_u32*)(work + writeBufferSize + sixelsSize);
+        encoder->band_.starts_ = CIXEL_REINTERPRET_CAST(cixel_s32*)(work + writeBufferSize + sixelsSize + colorUsedSize);
+        encoder->band_.ends_ = encoder->band_.starts_ + MAX_COLORS * 6;
+    }
+
+    /**
+    @brief Initialize an encoder without buffers, which placeEncoder points into its work
+    */
+    CIXEL_STATIC void initEncoder(CixelEncoder* encoder, AllocFunc allocFunc, FreeFunc freeFunc)
+    {
+        encoder->allocFunc_ = allocFunc;
+        encoder->freeFunc_ = freeFunc;
+        encoder->workspace_ = CIXEL_NULL;
+        selectKernels(&encoder->kernels_, getSIMD());
+
+        encoder->width_ = 0;
+        encoder->height_ = 0;
+        encoder->writeBuffer_ = CIXEL_NULL;
+        encoder->writeBufferSize_ = 0;
+        encoder->band_.sixels_ = CIXEL_NULL;
+        encoder->band_.colorFlags_ = CIXEL_NULL;
+        encoder->band_.starts_ = CIXEL_NULL;
+        encoder->band_.ends_ = CIXEL_NULL;
+        encoder->band_.buffer_ = CIXEL_NULL;
+        encoder->band_.size_ = 0;
+
+        encoder->numThreads_ = 1;
+        encoder->parallelFunc_ = CIXEL_NULL;
+        encoder->parallelUserData_ = CIXEL_NULL;
+        encoder->parallelWork_ = CIXEL_NULL;
+        encoder->bands_ = CIXEL_NULL;
+    }
+
+    CIXEL_STATIC bool setEncoderParallel(CixelEncoder* encoder, cixel_s32 numThreads, ParallelFunc parallelFunc, void* userData)
+    {
+        if(CIXEL_NULL != encoder->parallelWork_) {
+            encoder->freeFunc_(encoder->parallelWork_);
+            encoder->parallelWork_ = CIXEL_NULL;
+            encoder->bands_ = CIXEL_NULL;
+            encoder->band_.buffer_ = CIXEL_NULL;
+        }
+        encoder->numThreads_ = 1;
+        encoder->parallelFunc_ = CIXEL_NULL;
+        encoder->parallelUserData_ = CIXEL_NULL;
+        if(numThreads <= 1 || CIXEL_NULL == parallelFunc) {
+            return true;
+        }
+
+        cixel_size_t bandsSize = align(sizeof(Band) * (numThreads - 1));
+        cixel_size_t sixelsSize = align(sizeof(cixel_u8) * encoder->width_);
+        cixel_size_t colorUsedSize = align(MAX_COLORS);
+        cixel_size_t spansSize = align(sizeof(cixel_s32) * MAX_COLORS * 6) * 2;
+        cixel_size_t bandBufferSize = align(getBandBufferSize(encoder->width_));
+        cixel_size_t totalSize = bandsSize + (sixelsSize + colorUsedSize + spansSize) * (numThreads - 1) + bandBufferSize * numThreads;
+
+        void* parallelWork = encoder->allocFunc_(totalSize + ALIGN_SIZE);
+        if(CIXEL_NULL == parallelWork) {
+            return false;
+        }
+        uintptr_t ptr = (CIXEL_REINTERPRET_CAST(uintptr_t)(parallelWork) + ALIGN_OFFSET) & ALIGN_MASK;
+        cixel_u8* work = CIXEL_REINTERPRET_CAST(cixel_u8*)(ptr);
+        memset(work, 0, totalSize);
+
+        encoder->bands_ = CIXEL_REINTERPRET_CAST(Band*)(work);
+        work += bandsSize;
+        for(cixel_s32 i = 0; i < (numThreads - 1); ++i) {
+            encoder->bands_[i].sixels_ = work;
+            encoder->bands_[i].colorFlags_ = CIXEL_REINTERPRET_CAST(cixel_u32*)(work + sixelsSize);
+            encoder->bands_[i].starts_ = CIXEL_REINTERPRET_CAST(cixel_s32*)(work + sixelsSize + colorUsedSize);
+            encoder->bands_[i].ends_ = encoder->bands_[i].starts_ + MAX_COLORS * 6;
+            encoder->bands_[i].buffer_ = work + sixelsSize + colorUsedSize + spansSize;
+            work += sixelsSize + colorUsedSize + spansSize + bandBufferSize;
+        }
+        encoder->band_.buffer_ = work;
+        encoder->numThreads_ = numThreads;
+        encoder->parallelFunc_ = parallelFunc;
+        encoder->parallelUserData_ = userData;
+        encoder->parallelWork_ = parallelWork;
+        return true;
+    }
+
+    /**
+    @brief Sizes of buffers in the workspace of a context, which follows the context
+    */
+    struct Layout_t
+    {
+        cixel_size_t colorSize_;
+        cixel_size_t gridSize_;
+        cixel_size_t freqSize_;
+        cixel_size_t accSize_;
+        cixel_size_t yuvSize_;
+        cixel_size_t bucketSize_;
+        cixel_size_t cellSize_;
+        cixel_size_t errorSize_;
+        cixel_size_t palletSize_;
+        cixel_size_t encoderOffset_; //< buffers of the encoder follow the largest phase of quantization
+        cixel_size_t totalSize_;
+    };
+
+    typedef struct Layout_t Layout;
+
+    CIXEL_STATIC void getLayout(Layout* layout, cixel_s32 width, cixel_s32 height, cixel_u32 options)
+    {
+        // Always needs
+        layout->colorSize_ = align(sizeof(Color) * MAX_COLORS) * 2;
+        layout->gridSize_ = align(sizeof(cixel_s16) * GRID_SIZE);
+
+        // Buffer for quantization
+        layout->yuvSize_ = align(sizeof(Color) * width * height);
+
+        // Buffer for only quantization
+        layout->freqSize_ = align(sizeof(cixel_u32) * FREQUENCY_SIZE);
+        layout->accSize_ = align(sizeof(Color32) * FREQUENCY_SIZE);
+        layout->bucketSize_ = align(sizeof(Bucket) * (MAX_COLORS * 2));
+        layout->cellSize_ = ((width * height) <= SPARSE_LIMIT) ? align(sizeof(Cell) * width * height * 2) : 0;
+
+        // Buffer for only error diffution
+        layout->errorSize_ = align(sizeof(ColorS16) * (width + 2) * 2);
+        cixel_size_t stripIndicesSize = align(sizeof(cixel_u8) * width);
+
+        // Buffer for writing sixel, which is apart from the others so quantization does not clobber it
+        cixel_size_t encoderSize = (0 == (options & Option_QuantizeOnly)) ? getEncoderWorkSize(width) : 0;
+
+        // Tables are kept between quantizations, and cleared lazily
+        layout->palletSize_ = layout->colorSize_ + layout->gridSize_ + layout->freqSize_ + layout->accSize_;
+        cixel_size_t colorTableSize = align(sizeof(ColorTable));
+        cixel_size_t quantizationSize = layout->palletSize_ + maximum(layout->yuvSize_ + layout->bucketSize_ + layout->cellSize_, colorTableSize);
+        cixel_size_t diffusionSize = layout->palletSize_ + layout->yuvSize_ + layout->errorSize_ + stripIndicesSize;
+
+        layout->encoderOffset_ = maximum(quantizationSize, diffusionSize);
+        layout->totalSize_ = align(sizeof(Cixel)) + layout->encoderOffset_ + encoderSize;
+    }
+
+    /**
+    @brief Point buffers of a context into its workspace, tables at the top keep their place for any size of image
+    */
+    CIXEL_STATIC void placeBuffers(Cixel* cixel, const Layout* layout)
+    {
+        cixel_size_t colorSize = layout->colorSize_;
+        cixel_size_t gridSize = layout->gridSize_;
+        cixel_size_t freqSize = layout->freqSize_;
+        cixel_size_t palletSize = layout->palletSize_;
+        cixel_size_t yuvSize = layout->yuvSize_;
+        cixel_size_t bucketSize = layout->bucketSize_;
+        cixel_size_t cellSize = layout->cellSize_;
+        cixel_size_t errorSize = layout->errorSize_;
+        cixel_u8* work = CIXEL_REINTERPRET_CAST(cixel_u8*)(cixel) + align(sizeof(Cixel));
+
+        cixel->colors_ = CIXEL_REINTERPRET_CAST(Color*)(work);
+        cixel->pallet_ = CIXEL_REINTERPRET_CAST(Color*)(work + align(sizeof(Color) * MAX_COLORS));
+        cixel->grid_ = CIXEL_REINTERPRET_CAST(cixel_s16*)(work + colorSize);
+        cixel->frequencies_ = CIXEL_REINTERPRET_CAST(cixel_u32*)(work + colorSize + gridSize);
+        cixel->accColors_ = CIXEL_REINTERPRET_CAST(Color32*)(work + colorSize + gridSize + freqSize);
+
+        cixel->yuv_ = CIXEL_REINTERPRET_CAST(Color*)(work + palletSize);
+        cixel->boxes_ = CIXEL_REINTERPRET_CAST(Bucket*)(work + palletSize + yuvSize);
+        cixel->cells_ = (0 < cellSize) ? CIXEL_REINTERPRET_CAST(Cell*)(work + palletSize + yuvSize + bucketSize) : CIXEL_NULL;
+        cixel->sparseLimit_ = (0 < cellSize) ? SPARSE_LIMIT : 0;
+        cixel->colorTable_ = CIXEL_REINTERPRET_CAST(ColorTable*)(work + palletSize);
+
+        cixel->errors_ = CIXEL_REINTERPRET_CAST(ColorS16*)(work + palletSize + yuvSize);
+        cixel->strip_.errors_ = cixel->errors_;
+        cixel->strip_.indices_ = CIXEL_REINTERPRET_CAST(cixel_u8*)(work + palletSize + yuvSize + errorSize);
+
+        if(0 == (cixel->options_ & Option_QuantizeOnly)) {
+            placeEncoder(&cixel->encoder_, work + layout->encoderOffset_, cixel->width_, cixel->height_);
+        }
+    }
+
 CIXEL_NAMESPACE_EMPTY_END
 
 Cixel* cixelCreate(cixel_s32 width, cixel_s32 height, AllocFunc allocFunc, FreeFunc freeFunc)
+{
+    return cixelCreateWithOptions(width, height, Option_None, allocFunc, freeFunc);
+}
+
+Cixel* cixelCreateWithOptions(cixel_s32 width, cixel_s32 height, cixel_u32 options, AllocFunc allocFunc, FreeFunc freeFunc)
 {
     CIXEL_ASSERT(0 <= width);
     CIXEL_ASSERT(0 <= height);
@@ -1603,62 +3407,112 @@ Cixel* cixelCreate(cixel_s32 width, cixel_s32 height, AllocFunc allocFunc, FreeF
     if(CIXEL_NULL == freeFunc) {
         freeFunc = free;
     }
+    cixel_size_t size = cixelGetWorkspaceSize(width, height, options);
+    void* workspace = allocFunc(size);
+    if(CIXEL_NULL == workspace) {
+        return CIXEL_NULL;
+    }
+    Cixel* cixel = cixelCreateInPlace(workspace, size, width, height, options, allocFunc, freeFunc);
+    cixel->workspace_ = workspace;
+    return cixel;
+}
 
-    // Always needs
-    cixel_size_t colorSize = align(sizeof(Color) * MAX_COLORS);
-    cixel_size_t gridSize = align(sizeof(cixel_s16) * GRID_SIZE);
-
-    // Buffer for quantization
-    cixel_size_t yuvSize = align(sizeof(Color) * width * height);
-
-    // Buffer for only quantization
-    cixel_size_t freqSize = align(sizeof(cixel_u32) * FREQUENCY_SIZE);
-    cixel_size_t accSize = align(sizeof(Color32) * FREQUENCY_SIZE);
-    cixel_size_t bucketSize = align(sizeof(Bucket) * (MAX_COLORS * 2));
-
-    // Buffer for only error diffution
-    cixel_size_t errorSize = align(sizeof(ColorS32) * (width + 2) * (height + 1));
-
-    // Buffer for writing sixel
-    cixel_s32 sixelHeight = ((height + 5) / 6);
-    cixel_size_t writeBufferSize = align((MAX_COLORS * 18 + 1) + (width + 5) * MAX_COLORS * sixelHeight + sizeof(header) + sizeof(footer));
-    cixel_size_t indicesFlagsSize = align(sizeof(cixel_u8) * width * MAX_COLORS);
-    cixel_size_t colorUsedSize = align(MAX_COLORS);
-    cixel_size_t palletIndicesSize = align(MAX_COLORS);
-
-    cixel_size_t palletSize = colorSize + gridSize;
-    cixel_size_t quantizationSize = palletSize + yuvSize + freqSize + accSize + bucketSize;
-    cixel_size_t diffusionSize = palletSize + yuvSize + errorSize;
-    cixel_size_t writingSixelSize = palletSize + writeBufferSize + indicesFlagsSize + colorUsedSize + palletIndicesSize;
+cixel_size_t cixelGetWorkspaceSize(cixel_s32 width, cixel_s32 height, cixel_u32 options)
+{
+    CIXEL_ASSERT(0 <= width);
+    CIXEL_ASSERT(0 <= height);
+    Layout layout;
+    getLayout(&layout, width, height, options);
+    return layout.totalSize_ + ALIGN_SIZE;
+}
 
-    cixel_size_t cixelSize = align(sizeof(Cixel));
-    cixel_size_t totalSize = cixelSize + maximum(maximum(quantizationSize, diffusionSize), writingSixelSize);
+Cixel* cixelCreateInPlace(void* workspace, cixel_size_t size, cixel_s32 width, cixel_s32 height, cixel_u32 options, AllocFunc allocFunc, FreeFunc freeFunc)
+{
+    CIXEL_ASSERT(0 <= width);
+    CIXEL_ASSERT(0 <= height);
+    if(CIXEL_NULL == workspace || size < cixelGetWorkspaceSize(width, height, options)) {
+        return CIXEL_NULL;
+    }
+    if(CIXEL_NULL == allocFunc) {
+        allocFunc = malloc;
+    }
+    if(CIXEL_NULL == freeFunc) {
+        freeFunc = free;
+    }
+    Layout layout;
+    getLayout(&layout, width, height, options);
 
-    Cixel* cixel = CIXEL_REINTERPRET_CAST(Cixel*)(allocFunc(totalSize + ALIGN_SIZE));
+    uintptr_t ptr = (CIXEL_REINTERPRET_CAST(uintptr_t)(workspace) + ALIGN_OFFSET) & ALIGN_MASK;
+    Cixel* cixel = CIXEL_REINTERPRET_CAST(Cixel*)(ptr);
     cixel->allocFunc_ = allocFunc;
     cixel->freeFunc_ = freeFunc;
+    cixel->workspace_ = CIXEL_NULL;
+    cixel->capacity_ = size - (ptr - CIXEL_REINTERPRET_CAST(uintptr_t)(workspace));
+    cixel->options_ = options;
     cixel->width_ = width;
     cixel->height_ = height;
+    cixel->size_ = 0;
+    cixel->maxColors_ = MAX_COLORS;
+    cixel->dither_ = Dither_FloydSteinberg;
+    selectKernels(&cixel->kernels_, getSIMD());
 
-    uintptr_t ptr = (CIXEL_REINTERPRET_CAST(uintptr_t)(cixel) + cixelSize + ALIGN_OFFSET) & ALIGN_MASK;
-    cixel_u8* work = CIXEL_REINTERPRET_CAST(cixel_u8*)(ptr);
-
-    cixel->colors_ = CIXEL_REINTERPRET_CAST(Color*)(work);
-    cixel->grid_ = CIXEL_REINTERPRET_CAST(cixel_s16*)(work + colorSize);
-
-    cixel->yuv_ = CIXEL_REINTERPRET_CAST(Color*)(work + palletSize);
-
-    cixel->frequencies_ = CIXEL_REINTERPRET_CAST(cixel_u32*)(work + palletSize + yuvSize);
-    cixel->accColors_ = CIXEL_REINTERPRET_CAST(Color32*)(work + palletSize + yuvSize + freqSize);
-    cixel->boxes_ = CIXEL_REINTERPRET_CAST(Bucket*)(work + palletSize + yuvSize + freqSize + accSize);
-
-    cixel->errors_ = CIXEL_REINTERPRET_CAST(ColorS32*)(work + palletSize + yuvSize);
+    initEncoder(&cixel->encoder_, allocFunc, freeFunc);
+    placeBuffers(cixel, &layout);
+    memset(cixel->frequencies_, 0, layout.freqSize_ + layout.accSize_);
+    memset(cixel->grid_, -1, sizeof(cixel_s16) * GRID_SIZE);
+    resetBox(&cixel->dirty_);
+    resetBox(&cixel->gridBox_);
+    cixel->sparse_ = false;
+
+    cixel->priorityFunc_ = CIXEL_NULL;
+
+    cixel->numThreads_ = 1;
+    cixel->parallelFunc_ = CIXEL_NULL;
+    cixel->parallelUserData_ = CIXEL_NULL;
+    cixel->parallelWork_ = CIXEL_NULL;
+    cixel->parallelWidth_ = 0;
+    cixel->parallelHeight_ = 0;
+    cixel->histograms_ = CIXEL_NULL;
+    cixel->strips_ = CIXEL_NULL;
+    cixel->ring_ = CIXEL_NULL;
+    cixel->progress_ = CIXEL_NULL;
+    return cixel;
+}
 
-    cixel->writeBuffer_ = CIXEL_REINTERPRET_CAST(cixel_u8*)(work + palletSize);
-    cixel->indicesFlags_ = CIXEL_REINTERPRET_CAST(cixel_u8*)(work + palletSize + writeBufferSize);
-    cixel->colorFlags_ = CIXEL_REINTERPRET_CAST(cixel_u32*)(work + palletSize + writeBufferSize + indicesFlagsSize);
-    cixel->palletIndices_ = CIXEL_REINTERPRET_CAST(cixel_u8*)(work + palletSize + writeBufferSize + indicesFlagsSize + colorUsedSize);
+Cixel* cixelResize(Cixel* cixel, cixel_s32 width, cixel_s32 height)
+{
+    CIXEL_ASSERT(CIXEL_NULL != cixel);
+    CIXEL_ASSERT(0 <= width);
+    CIXEL_ASSERT(0 <= height);
+    Layout layout;
+    getLayout(&layout, width, height, cixel->options_);
+    if(cixel->capacity_ < layout.totalSize_) {
+        if(CIXEL_NULL == cixel->workspace_) {
+            return CIXEL_NULL;
+        }
+        // Grows geometrically, so a window resized step by step allocates a few times
+        cixel_size_t size = maximum(layout.totalSize_, cixel->capacity_ * 2) + ALIGN_SIZE;
+        void* workspace = cixel->allocFunc_(size);
+        if(CIXEL_NULL == workspace) {
+            return CIXEL_NULL;
+        }
+        // The context and the tables kept between quantizations move, the rest is rebuilt by the next quantization
+        uintptr_t ptr = (CIXEL_REINTERPRET_CAST(uintptr_t)(workspace) + ALIGN_OFFSET) & ALIGN_MASK;
+        Cixel* resized = CIXEL_REINTERPRET_CAST(Cixel*)(ptr);
+        memcpy(resized, cixel, align(sizeof(Cixel)) + layout.palletSize_);
+        cixel->freeFunc_(cixel->workspace_);
+        cixel = resized;
+        cixel->workspace_ = workspace;
+        cixel->capacity_ = size - (ptr - CIXEL_REINTERPRET_CAST(uintptr_t)(workspace));
+    }
+    cixel->width_ = width;
+    cixel->height_ = height;
+    placeBuffers(cixel, &layout);
 
+    // Work of threads is kept for smaller images
+    if(1 < cixel->numThreads_ && (cixel->parallelWidth_ < width || cixel->parallelHeight_ < height)) {
+        cixelSetParallel(cixel, cixel->numThreads_, cixel->parallelFunc_, cixel->parallelUserData_);
+    }
     return cixel;
 }
 
@@ -1667,7 +3521,98 @@ void cixelDestroy(Cixel* cixel)
     if(CIXEL_NULL == cixel){
         return;
     }
-    cixel->freeFunc_(cixel);
+    if(CIXEL_NULL != cixel->parallelWork_) {
+        cixel->freeFunc_(cixel->parallelWork_);
+    }
+    if(CIXEL_NULL != cixel->encoder_.parallelWork_) {
+        cixel->freeFunc_(cixel->encoder_.parallelWork_);
+    }
+    if(CIXEL_NULL != cixel->workspace_) {
+        cixel->freeFunc_(cixel->workspace_);
+    }
+}
+
+bool cixelSetParallel(Cixel* cixel, cixel_s32 numThreads, ParallelFunc parallelFunc, void* userData)
+{
+    CIXEL_ASSERT(CIXEL_NULL != cixel);
+    if(CIXEL_NULL != cixel->parallelWork_) {
+        cixel->freeFunc_(cixel->parallelWork_);
+        cixel->parallelWork_ = CIXEL_NULL;
+        cixel->histograms_ = CIXEL_NULL;
+        cixel->strips_ = CIXEL_NULL;
+        cixel->ring_ = CIXEL_NULL;
+        cixel->progress_ = CIXEL_NULL;
+    }
+    cixel->numThreads_ = 1;
+    cixel->parallelFunc_ = CIXEL_NULL;
+    cixel->parallelUserData_ = CIXEL_NULL;
+    if(0 == (cixel->options_ & Option_QuantizeOnly) && !setEncoderParallel(&cixel->encoder_, numThreads, parallelFunc, userData)) {
+        return false;
+    }
+    if(numThreads <= 1 || CIXEL_NULL == parallelFunc) {
+        return true;
+    }
+
+    cixel_size_t histogramsSize = align(sizeof(Histogram) * (numThreads - 1));
+    cixel_size_t freqSize = align(sizeof(cixel_u32) * FREQUENCY_SIZE);
+    cixel_size_t accSize = align(sizeof(Color32) * FREQUENCY_SIZE);
+    cixel_size_t stripsSize = align(sizeof(Strip) * (numThreads - 1));
+    cixel_size_t stripErrorsSize = align(sizeof(ColorS16) * (cixel->width_ + 2) * 2);
+    cixel_size_t stripIndicesSize = align(sizeof(cixel_u8) * cixel->width_);
+    cixel_size_t ringSize = align(sizeof(ColorS16) * (cixel->width_ + 2) * (numThreads + 1));
+    cixel_size_t progressSize = align(sizeof(cixel_s32) * cixel->height_);
+    cixel_size_t totalSize = histogramsSize + (freqSize + accSize) * (numThreads - 1) + stripsSize + (stripErrorsSize + stripIndicesSize) * (numThreads - 1) + ringSize + progressSize;
+
+    void* parallelWork = cixel->allocFunc_(totalSize + ALIGN_SIZE);
+    if(CIXEL_NULL == parallelWork) {
+        setEncoderParallel(&cixel->encoder_, 1, CIXEL_NULL, CIXEL_NULL);
+        return false;
+    }
+    uintptr_t ptr = (CIXEL_REINTERPRET_CAST(uintptr_t)(parallelWork) + ALIGN_OFFSET) & ALIGN_MASK;
+    cixel_u8* work = CIXEL_REINTERPRET_CAST(cixel_u8*)(ptr);
+    memset(work, 0, totalSize);
+
+    cixel->histograms_ = CIXEL_REINTERPRET_CAST(Histogram*)(work);
+    work += histogramsSize;
+    for(cixel_s32 i = 0; i < (numThreads - 1); ++i) {
+        cixel->histograms_[i].frequencies_ = CIXEL_REINTERPRET_CAST(cixel_u32*)(work);
+        cixel->histograms_[i].accColors_ = CIXEL_REINTERPRET_CAST(Color32*)(work + freqSize);
+        work += freqSize + accSize;
+    }
+    cixel->strips_ = CIXEL_REINTERPRET_CAST(Strip*)(work);
+    work += stripsSize;
+    for(cixel_s32 i = 0; i < (numThreads - 1); ++i) {
+        cixel->strips_[i].errors_ = CIXEL_REINTERPRET_CAST(ColorS16*)(work);
+        cixel->strips_[i].indices_ = work + stripErrorsSize;
+        work += stripErrorsSize + stripIndicesSize;
+    }
+    cixel->ring_ = CIXEL_REINTERPRET_CAST(ColorS16*)(work);
+    cixel->progress_ = CIXEL_REINTERPRET_CAST(cixel_s32*)(work + ringSize);
+    cixel->numThreads_ = numThreads;
+    cixel->parallelFunc_ = parallelFunc;
+    cixel->parallelUserData_ = userData;
+    cixel->parallelWork_ = parallelWork;
+    cixel->parallelWidth_ = cixel->width_;
+    cixel->parallelHeight_ = cixel->height_;
+    return true;
+}
+
+void cixelSetPriority(Cixel* cixel, PriorityFunc priorityFunc)
+{
+    CIXEL_ASSERT(CIXEL_NULL != cixel);
+    cixel->priorityFunc_ = priorityFunc;
+}
+
+void cixelSetMaxColors(Cixel* cixel, cixel_s32 maxColors)
+{
+    CIXEL_ASSERT(CIXEL_NULL != cixel);
+    cixel->maxColors_ = clamp(maxColors, 1, MAX_COLORS);
+}
+
+void cixelSetDither(Cixel* cixel, Dither dither)
+{
+    CIXEL_ASSERT(CIXEL_NULL != cixel);
+    cixel->dither_ = dither;
 }
 
 void cixelQuantize(Cixel* cixel, cixel_u8* CIXEL_RESTRICT indices, const cixel_u32* CIXEL_RESTRICT pixels, bool flipVertical)
@@ -1676,74 +3621,93 @@ void cixelQuantize(Cixel* cixel, cixel_u8* CIXEL_RESTRICT indices, const cixel_u
     CIXEL_ASSERT(CIXEL_NULL != pixels);
     CIXEL_ASSERT(0 <= cixel->width_);
     CIXEL_ASSERT(0 <= cixel->height_);
-#if defined(CIXEL_SSE)
-#ifdef __cplusplus
-    setZero16<align16(sizeof(cixel_u32) * FREQUENCY_SIZE)>(cixel->frequencies_);
-    setZero16<align16(sizeof(Color32) * FREQUENCY_SIZE)>(cixel->accColors_);
-    setMinusOne16<align16(sizeof(cixel_s16) * GRID_SIZE)>(cixel->grid_);
-#else
-    setZero16(cixel->frequencies_, align16(sizeof(cixel_u32) * FREQUENCY_SIZE));
-    setZero16(cixel->accColors_, align16(sizeof(Color32) * FREQUENCY_SIZE));
-    setMinusOne16(cixel->grid_, align16(sizeof(cixel_s16) * GRID_SIZE));
-#endif
-
-#else
-    memset(cixel->frequencies_, 0, sizeof(cixel_u32) * FREQUENCY_SIZE);
-    memset(cixel->accColors_, 0, sizeof(Color32) * FREQUENCY_SIZE);
-    memset(cixel->grid_, -1, sizeof(cixel_s16) * GRID_SIZE);
-#endif
+    if(mapColors(cixel, indices, pixels, flipVertical)) {
+        return;
+    }
+    clearTables(cixel);
     Bucket* buckets = cixel->boxes_;
-#ifdef __cplusplus
-    buckets[0] = {
-        {
-            {CIXEL_STATIC_CAST(cixel_u8)(RESOLUTION_Y - 1), CIXEL_STATIC_CAST(cixel_u8)(RESOLUTION_U - 1), CIXEL_STATIC_CAST(cixel_u8)(RESOLUTION_V - 1), 0},
-            {}
-        },
-        0
-    };
-#else
-    buckets[0] = (Bucket){
-        {
-            {CIXEL_STATIC_CAST(cixel_u8)(RESOLUTION_Y - 1), CIXEL_STATIC_CAST(cixel_u8)(RESOLUTION_U - 1), CIXEL_STATIC_CAST(cixel_u8)(RESOLUTION_V - 1), 0},
-            {0, 0, 0, 0},
-        },
-        0
-    };
-#endif
-
-    if(flipVertical){
-        getAccumulationsFlipVertical(cixel, buckets, pixels);
-
+    cixel->sparse_ = (cixel->width_ * cixel->height_) <= cixel->sparseLimit_;
+    if(cixel->sparse_) {
+        // Small images do median cut on the list of occupied cells, unless the cells are dense in their bounds
+        cixel_s32 numCells = getSparseAccumulations(cixel, &buckets[0].box_, pixels, flipVertical);
+        buckets[0].cellStart_ = 0;
+        buckets[0].cellEnd_ = numCells;
+        cixel->sparse_ = (numCells * SPARSE_DENSITY) <= getVolume(&buckets[0].box_);
+        if(!cixel->sparse_) {
+            scatterCells(cixel, numCells);
+            cixel->dirty_ = buckets[0].box_;
+            calcPrefixSum(cixel, &buckets[0].box_);
+        }
     } else {
-        getAccumulations(cixel, buckets, pixels);
-
-    }
-
-    calcPrefixSum(cixel);
-    cixel->boxes_[0].frequency_ = getSum(cixel, &(cixel->boxes_[0].box_));
-
-    cixel_s32 ncolors = 256;
-    cixel_s32 candidate = 0;
-    cixel_s32 numBoxes = 1;
-    for(; candidate < numBoxes && numBoxes < ncolors;) {
-        bool success = medianCut(cixel, &buckets[candidate], &buckets[numBoxes], &buckets[candidate]);
-        if(success) {
-            sortToUpper(candidate, numBoxes + 1, cixel->boxes_);
-            sortToLower(candidate, numBoxes, cixel->boxes_);
-            ++numBoxes;
+        Histogram histogram;
+        histogram.frequencies_ = cixel->frequencies_;
+        histogram.accColors_ = cixel->accColors_;
+        cixel_s32 numJobs = minimum(cixel->numThreads_, cixel->height_);
+        if(1 < numJobs) {
+            AccumulationJob job;
+            job.cixel_ = cixel;
+            job.histogram_ = &histogram;
+            job.pixels_ = pixels;
+            job.flipVertical_ = flipVertical;
+            job.numJobs_ = numJobs;
+            cixel->parallelFunc_(accumulationJob, &job, numJobs, cixel->parallelUserData_);
+            for(cixel_s32 i = 1; i < numJobs; ++i) {
+                mergeHistogram(&histogram, &cixel->histograms_[i - 1]);
+            }
         } else {
-            ++candidate;
+            resetBox(&histogram.box_);
+            getAccumulations(cixel, &histogram, pixels, flipVertical, 0, cixel->height_);
         }
+        buckets[0].box_ = histogram.box_;
+        cixel->dirty_ = histogram.box_;
+        calcPrefixSum(cixel, &histogram.box_);
     }
+    clearGrid(cixel, &buckets[0].box_);
+    buckets[0].frequency_ = getBucketSum(cixel, &buckets[0]);
+    setPriority(cixel, &buckets[0]);
+
+    // Split the box of the highest priority, boxes which cannot be split are retired to the upper half of buckets
+    cixel_s32 ncolors = cixel->maxColors_;
+    Bucket* retired = buckets + MAX_COLORS;
+    cixel_s32 numHeap = 1;
+    cixel_s32 numRetired = 0;
+    while(0 < numHeap && (numHeap + numRetired) < ncolors) {
+        Bucket top;
+        Bucket bucket0;
+        Bucket bucket1;
+        popHeap(buckets, numHeap, &top);
+        --numHeap;
+        if(!medianCut(cixel, &bucket0, &bucket1, &top)) {
+            retired[numRetired] = top;
+            ++numRetired;
+            continue;
+        }
+        // Empty boxes never become colors
+        if(0 < bucket0.frequency_) {
+            setPriority(cixel, &bucket0);
+            pushHeap(buckets, numHeap, &bucket0);
+            ++numHeap;
+        }
+        if(0 < bucket1.frequency_) {
+            setPriority(cixel, &bucket1);
+            pushHeap(buckets, numHeap, &bucket1);
+            ++numHeap;
+        }
+    }
+    for(cixel_s32 i = 0; i < numRetired; ++i) {
+        buckets[numHeap + i] = retired[i];
+    }
+    cixel_s32 numBoxes = numHeap + numRetired;
 
     cixel->size_ = 0;
     Color color;
     for(cixel_s32 i = 0; i < numBoxes; ++i) {
-        if(!calcCenterColor(cixel, &color, &buckets[i].box_)) {
+        if(!calcCenterColor(cixel, &color, &buckets[i])) {
             continue;
         }
         add(cixel, color, &buckets[i].box_);
     }
+    fillGrid(cixel);
 
 #ifdef _DEBUG
     // validate
@@ -1758,107 +3722,221 @@ void cixelQuantize(Cixel* cixel, cixel_u8* CIXEL_RESTRICT indices, const cixel_u
         }
     }
 #endif
-    errorDiffusion(cixel, indices);
+    dither(cixel, indices);
 }
 
-void cixelPrint(Cixel* cixel, FILE* file, const cixel_u8* CIXEL_RESTRICT indices)
-{
-    CIXEL_ASSERT(CIXEL_NULL != cixel);
-    CIXEL_ASSERT(CIXEL_NULL != file);
-    CIXEL_ASSERT(CIXEL_NULL != indices);
-
-    cixel_s32 width = cixel->width_;
-    cixel_s32 height = cixel->height_;
-    cixel_s32 size = cixel->size_;
-
-    const Color* colors = cixel->colors_;
-    cixel_u8* writeBuffer = cixel->writeBuffer_;
-    cixel_u8* indicesFlags = cixel->indicesFlags_;
-    cixel_u32* colorFlags = cixel->colorFlags_;
-    cixel_u8* palletIndices = cixel->palletIndices_;
-
-    cixel_s32 outHeight = ((height + 5) / 6) * 6;
-    cixel_s32 pos = 0;
-    pos = cixelWrite(pos, writeBuffer, sizeof(header), header);
-    // Write a pallet
-    for(cixel_s32 i = 0; i < size; ++i) {
-        cixel_s32 rgba[4];
-        YUV2RGBPercent(rgba, colors[i].color_);
-        pos = writePalletColor(pos, writeBuffer, i, rgba[0], rgba[1], rgba[2]);
-    }
+CIXEL_NAMESPACE_EMPTY_BEGIN
+    /**
+    @brief Indices with their pallet to encode, which is not wider than the encoder
+    */
+    struct Image_t
+    {
+        const cixel_u8* indices_;
+        const Color* pallet_; //< RGB
+        cixel_s32 size_; //< number of colors
+        cixel_s32 width_;
+        cixel_s32 height_;
+    };
 
-#if defined(CIXEL_SSE)
-    setZero16(indicesFlags, sizeof(cixel_u8) * width * MAX_COLORS);
-#else
-    memset(indicesFlags, 0, sizeof(cixel_u8) * width * MAX_COLORS);
-#endif
+    typedef struct Image_t Image;
 
-    cixel_s32 block = width * 6;
-    cixel_s32 row = 0;
-    for(cixel_s32 i = 0; i < outHeight; i += 6, row += block) {
-        for(cixel_s32 j=0; j<(MAX_COLORS/32); ++j){
+    /**
+    @brief Write passes of colors of a band, and a graphics new line
+    @return position to write next
+    */
+    CIXEL_STATIC cixel_s32 encodeBand(const CixelEncoder* encoder, Band* band, Writer* writer, cixel_s32 pos, const Image* image, cixel_s32 bandIndex)
+    {
+        cixel_s32 width = image->width_;
+        cixel_s32 size = image->size_;
+        cixel_u8* sixels = band->sixels_;
+        cixel_u32* colorFlags = band->colorFlags_;
+        cixel_s32* starts = band->starts_;
+        cixel_s32* ends = band->ends_;
+
+        // Spans of colors in each row are only stored, the last store backward is the first column
+        cixel_s32 hblock = minimum(6, image->height_ - bandIndex * 6);
+        const cixel_u8* rows = image->indices_ + bandIndex * 6 * width;
+        for(cixel_s32 j = 0; j < hblock; ++j) {
+            const cixel_u8* row = rows + width * j;
+            cixel_s32* rowStarts = starts + MAX_COLORS * j;
+            cixel_s32* rowEnds = ends + MAX_COLORS * j;
+            for(cixel_s32 c = 0; c < size; ++c) {
+                rowStarts[c] = width;
+                rowEnds[c] = 0;
+            }
+            for(cixel_s32 k = 0; k < width; ++k) {
+                rowEnds[row[k]] = k + 1;
+            }
+            for(cixel_s32 k = width - 1; 0 <= k; --k) {
+                rowStarts[row[k]] = k;
+            }
+        }
+        for(cixel_s32 j = 1; j < hblock; ++j) {
+            const cixel_s32* rowStarts = starts + MAX_COLORS * j;
+            const cixel_s32* rowEnds = ends + MAX_COLORS * j;
+            for(cixel_s32 c = 0; c < size; ++c) {
+                starts[c] = minimum(starts[c], rowStarts[c]);
+                ends[c] = maximum(ends[c], rowEnds[c]);
+            }
+        }
+        cixel_s32 flagBlocks = (size + 31) >> 5;
+        for(cixel_s32 j = 0; j < flagBlocks; ++j) {
             colorFlags[j] = 0;
         }
-        cixel_s32 hblock = minimum(6, height - i);
-        cixel_s32 colorCount = 0;
-        for(cixel_s32 j = 0, trow0 = row; j < hblock; ++j, trow0 += width) {
-            for(cixel_s32 k = 0; k < width; ++k) {
-                cixel_u8 color = indices[trow0 + k];
-                cixel_u8 flagBlock = color>>5;
-                cixel_u32 flag = 0x01U<<(color&31U);
-                if(0 == (colorFlags[flagBlock]&flag)){
-                    colorFlags[flagBlock] |= flag;
-                    palletIndices[colorCount] = color;
-                    ++colorCount;
+        for(cixel_s32 c = 0; c < size; ++c) {
+            colorFlags[c >> 5] |= (0 < ends[c]) ? (0x01U << (c & 31)) : 0;
+        }
+
+        // Sixels of each color are built from the rows only in its span, and written in order of indices
+        bool first = true;
+        for(cixel_s32 j = 0; j < flagBlocks; ++j) {
+            for(cixel_u32 flags = colorFlags[j]; 0 != flags; flags &= flags - 1) {
+                cixel_u8 color = CIXEL_STATIC_CAST(cixel_u8)((j << 5) + countTrailingZeros(flags));
+                cixel_s32 spanStart = starts[color];
+                cixel_s32 spanEnd = ends[color];
+                encoder->kernels_.buildSixels_(sixels, rows, width, hblock, color, spanStart, spanEnd);
+
+                pos = reserve(writer, pos, width + PASS_RESERVE);
+                if(!first) {
+                    pos = put(pos, writer->buffer_, '$');
+                }
+                first = false;
+                pos = writeColorIndex(pos, writer->buffer_, color);
+                // A pass skips empty columns before its span with a repeat, and stops at the end of its span
+                if(0 < spanStart) {
+                    pos = writeBits(pos, writer->buffer_, spanStart, 0);
                 }
-                indicesFlags[width * color + k] |= (0x01U << j);
+                for(cixel_s32 k = spanStart; k < spanEnd;) {
+                    cixel_u8 bits = sixels[k];
+                    CIXEL_ASSERT(bits <= 0x3FU);
+                    cixel_s32 end = encoder->kernels_.findRunEnd_(sixels, k, spanEnd);
+                    pos = writeBits(pos, writer->buffer_, end - k, bits);
+                    k = end;
+                }
+                CIXEL_ASSERT(0 != sixels[spanEnd - 1]);
             }
         }
 
-        for(cixel_s32 j = 0; j < colorCount; ++j) {
-            if(0 < j) {
-                pos = put(pos, writeBuffer, '$');
-            }
-            cixel_u8 color = palletIndices[j];
-            cixel_s32 colorWidth = width * color;
-            pos = writeColorIndex(pos, writeBuffer, color);
+        pos = reserve(writer, pos, PASS_RESERVE);
+        pos = put(pos, writer->buffer_, '-'); // graphics new line '-'
+        return pos;
+    }
 
-            cixel_s32 run = 0;
-            cixel_u8 prevBits = 0xFFU;
-            for(cixel_s32 k = 0; k < width; ++k) {
-                cixel_u8 bits = indicesFlags[colorWidth + k];
-                indicesFlags[colorWidth + k] = 0;
-                CIXEL_ASSERT(bits <= 0x3FU);
-                if(prevBits != bits) {
-                    if(0 < run) {
-                        pos = writeBits(pos, writeBuffer, run, prevBits);
-                        run = 0;
-                    }
-                }
-                prevBits = bits;
-                ++run;
-                if(256 <= run) {
-                    pos = writeBits(pos, writeBuffer, 255, bits);
-                    run -= 255;
+    struct BandJob_t
+    {
+        CixelEncoder* encoder_;
+        const Image* image_;
+        cixel_s32 firstBand_;
+    };
+
+    typedef struct BandJob_t BandJob;
+
+    CIXEL_STATIC void encodeBandJob(void* args, cixel_s32 index)
+    {
+        BandJob* job = CIXEL_REINTERPRET_CAST(BandJob*)(args);
+        CixelEncoder* encoder = job->encoder_;
+        Band* band = (0 == index) ? &encoder->band_ : &encoder->bands_[index - 1];
+
+        // The buffer takes the worst case of a band, so it is never written out
+        Writer writer;
+        writer.buffer_ = band->buffer_;
+        writer.capacity_ = getBandBufferSize(encoder->width_);
+        writer.staging_ = band->buffer_;
+        writer.stagingSize_ = writer.capacity_;
+        writer.writeFunc_ = CIXEL_NULL;
+        writer.userData_ = CIXEL_NULL;
+        writer.destination_ = CIXEL_NULL;
+        writer.destinationSize_ = 0;
+        writer.total_ = 0;
+        band->size_ = encodeBand(encoder, band, &writer, 0, job->image_, job->firstBand_ + index);
+        CIXEL_ASSERT(0 == writer.total_);
+    }
+
+    CIXEL_STATIC void print(CixelEncoder* encoder, Writer* writer, const Image* image)
+    {
+        CIXEL_ASSERT(image->width_ <= encoder->width_);
+        cixel_s32 height = image->height_;
+        cixel_s32 size = image->size_;
+        const Color* pallet = image->pallet_;
+
+        cixel_s32 pos = 0;
+        pos = cixelWrite(pos, writer->buffer_, sizeof(header), header);
+        // Write a pallet
+        for(cixel_s32 i = 0; i < size; ++i) {
+            cixel_s32 rgba[4];
+            RGB2Percent(rgba, pallet[i].color_);
+            pos = reserve(writer, pos, 18); // "#255;2;100;100;100"
+            pos = writePalletColor(pos, writer->buffer_, i, rgba[0], rgba[1], rgba[2]);
+        }
+
+        // Bands are encoded at once as many as threads, then written in order
+        cixel_s32 numBands = (height + 5) / 6;
+        cixel_s32 numJobs = minimum(encoder->numThreads_, numBands);
+        if(1 < numJobs) {
+            BandJob job;
+            job.encoder_ = encoder;
+            job.image_ = image;
+            for(cixel_s32 i = 0; i < numBands; i += numJobs) {
+                cixel_s32 count = minimum(numJobs, numBands - i);
+                job.firstBand_ = i;
+                encoder->parallelFunc_(encodeBandJob, &job, count, encoder->parallelUserData_);
+                for(cixel_s32 j = 0; j < count; ++j) {
+                    const Band* band = (0 == j) ? &encoder->band_ : &encoder->bands_[j - 1];
+                    pos = append(writer, pos, band->buffer_, band->size_);
                 }
             }
-            if(0 < run) {
-                pos = writeBits(pos, writeBuffer, run, prevBits);
+        } else {
+            for(cixel_s32 i = 0; i < numBands; ++i) {
+                pos = encodeBand(encoder, &encoder->band_, writer, pos, image, i);
             }
         }
-
-        pos = put(pos, writeBuffer, '-'); // graphics new line '-'
+        pos = reserve(writer, pos, PASS_RESERVE);
+        pos = cixelWrite(pos, writer->buffer_, sizeof(footer), footer);
+        flush(writer, pos, 0);
     }
-    pos = cixelWrite(pos, writeBuffer, sizeof(footer), footer);
-#ifdef _DEBUG
+
+    CIXEL_STATIC void initImage(Image* image, const cixel_u8* indices, const Color* pallet, cixel_s32 size, cixel_s32 width, cixel_s32 height)
     {
-        cixel_s32 sixelHeight = ((height + 5) / 6);
-        cixel_size_t writeBufferSize =
-            align((256 * 18 + 1) + (width + 5) * 256 * sixelHeight + sizeof(header) + sizeof(footer));
-        CIXEL_ASSERT(pos <= writeBufferSize);
+        image->indices_ = indices;
+        image->pallet_ = pallet;
+        image->size_ = size;
+        image->width_ = width;
+        image->height_ = height;
     }
-#endif
-    fwrite(writeBuffer, pos, 1, file);
+CIXEL_NAMESPACE_EMPTY_END
+
+void cixelPrint(Cixel* cixel, FILE* file, const cixel_u8* CIXEL_RESTRICT indices)
+{
+    CIXEL_ASSERT(CIXEL_NULL != file);
+    cixelPrintTo(cixel, writeFile, file, indices);
+}
+
+void cixelPrintTo(Cixel* cixel, WriteFunc writeFunc, void* userData, const cixel_u8* CIXEL_RESTRICT indices)
+{
+    CIXEL_ASSERT(CIXEL_NULL != cixel);
+    CIXEL_ASSERT(0 == (cixel->options_ & Option_QuantizeOnly));
+    CIXEL_ASSERT(CIXEL_NULL != writeFunc);
+    CIXEL_ASSERT(CIXEL_NULL != indices);
+    Image image;
+    initImage(&image, indices, cixel->pallet_, cixel->size_, cixel->width_, cixel->height_);
+    Writer writer;
+    initWriter(&writer, &cixel->encoder_, writeFunc, userData, CIXEL_NULL, 0);
+    print(&cixel->encoder_, &writer, &image);
+}
+
+cixel_size_t cixelPrintToMemory(Cixel* cixel, cixel_u8* buffer, cixel_size_t capacity, const cixel_u8* CIXEL_RESTRICT indices)
+{
+    CIXEL_ASSERT(CIXEL_NULL != cixel);
+    CIXEL_ASSERT(0 == (cixel->options_ & Option_QuantizeOnly));
+    CIXEL_ASSERT(CIXEL_NULL != buffer || 0 == capacity);
+    CIXEL_ASSERT(CIXEL_NULL != indices);
+    Image image;
+    initImage(&image, indices, cixel->pallet_, cixel->size_, cixel->width_, cixel->height_);
+    Writer writer;
+    initWriter(&writer, &cixel->encoder_, CIXEL_NULL, CIXEL_NULL, buffer, capacity);
+    flush(&writer, 0, sizeof(header));
+    print(&cixel->encoder_, &writer, &image);
+    return writer.total_;
 }
 
 Color cixelGetPalletColor(const Cixel* cixel, cixel_s32 index)
@@ -1866,5 +3944,144 @@ Color cixelGetPalletColor(const Cixel* cixel, cixel_s32 index)
     return cixel->colors_[index];
 }
 
+void cixelGetPallet(const Cixel* cixel, Pallet* pallet)
+{
+    CIXEL_ASSERT(CIXEL_NULL != cixel);
+    CIXEL_ASSERT(CIXEL_NULL != pallet);
+    pallet->size_ = cixel->size_;
+    memcpy(pallet->colors_, cixel->pallet_, sizeof(Color) * cixel->size_);
+}
+
+CixelEncoder* cixelEncoderCreate(cixel_s32 width, cixel_s32 height, AllocFunc allocFunc, FreeFunc freeFunc)
+{
+    CIXEL_ASSERT(0 <= width);
+    CIXEL_ASSERT(0 <= height);
+    if(CIXEL_NULL == allocFunc) {
+        allocFunc = malloc;
+    }
+    if(CIXEL_NULL == freeFunc) {
+        freeFunc = free;
+    }
+    cixel_size_t size = cixelEncoderGetWorkspaceSize(width, height);
+    void* workspace = allocFunc(size);
+    if(CIXEL_NULL == workspace) {
+        return CIXEL_NULL;
+    }
+    CixelEncoder* encoder = cixelEncoderCreateInPlace(workspace, size, width, height, allocFunc, freeFunc);
+    encoder->workspace_ = workspace;
+    return encoder;
+}
+
+cixel_size_t cixelEncoderGetWorkspaceSize(cixel_s32 width, cixel_s32 height)
+{
+    CIXEL_ASSERT(0 <= width);
+    CIXEL_ASSERT(0 <= height);
+    (void)height;
+    return align(sizeof(CixelEncoder)) + getEncoderWorkSize(width) + ALIGN_SIZE;
+}
+
+CixelEncoder* cixelEncoderCreateInPlace(void* workspace, cixel_size_t size, cixel_s32 width, cixel_s32 height, AllocFunc allocFunc, FreeFunc freeFunc)
+{
+    CIXEL_ASSERT(0 <= width);
+    CIXEL_ASSERT(0 <= height);
+    if(CIXEL_NULL == workspace || size < cixelEncoderGetWorkspaceSize(width, height)) {
+        return CIXEL_NULL;
+    }
+    if(CIXEL_NULL == allocFunc) {
+        allocFunc = malloc;
+    }
+    if(CIXEL_NULL == freeFunc) {
+        freeFunc = free;
+    }
+    uintptr_t ptr = (CIXEL_REINTERPRET_CAST(uintptr_t)(workspace) + ALIGN_OFFSET) & ALIGN_MASK;
+    CixelEncoder* encoder = CIXEL_REINTERPRET_CAST(CixelEncoder*)(ptr);
+    initEncoder(encoder, allocFunc, freeFunc);
+    placeEncoder(encoder, CIXEL_REINTERPRET_CAST(cixel_u8*)(ptr + align(sizeof(CixelEncoder))), width, height);
+    return encoder;
+}
+
+void cixelEncoderDestroy(CixelEncoder* encoder)
+{
+    if(CIXEL_NULL == encoder) {
+        return;
+    }
+    if(CIXEL_NULL != encoder->parallelWork_) {
+        encoder->freeFunc_(encoder->parallelWork_);
+    }
+    if(CIXEL_NULL != encoder->workspace_) {
+        encoder->freeFunc_(encoder->workspace_);
+    }
+}
+
+bool cixelEncoderSetParallel(CixelEncoder* encoder, cixel_s32 numThreads, ParallelFunc parallelFunc, void* userData)
+{
+    CIXEL_ASSERT(CIXEL_NULL != encoder);
+    return setEncoderParallel(encoder, numThreads, parallelFunc, userData);
+}
+
+void cixelEncode(CixelEncoder* encoder, const Pallet* pallet, WriteFunc writeFunc, void* userData, const cixel_u8* CIXEL_RESTRICT indices)
+{
+    CIXEL_ASSERT(CIXEL_NULL != encoder);
+    CIXEL_ASSERT(CIXEL_NULL != pallet);
+    CIXEL_ASSERT(0 <= pallet->size_ && pallet->size_ <= MAX_COLORS);
+    CIXEL_ASSERT(CIXEL_NULL != writeFunc);
+    CIXEL_ASSERT(CIXEL_NULL != indices);
+    Image image;
+    initImage(&image, indices, pallet->colors_, pallet->size_, encoder->width_, encoder->height_);
+    Writer writer;
+    initWriter(&writer, encoder, writeFunc, userData, CIXEL_NULL, 0);
+    print(encoder, &writer, &image);
+}
+
+void cixelEncodeIndexed(CixelEncoder* encoder, cixel_s32 width, cixel_s32 height, const cixel_u32* pallet, cixel_s32 numColors, WriteFunc writeFunc, void* userData, const cixel_u8* CIXEL_RESTRICT indices)
+{
+    CIXEL_ASSERT(CIXEL_NULL != encoder);
+    CIXEL_ASSERT(0 <= width && width <= encoder->width_);
+    CIXEL_ASSERT(0 <= height);
+    CIXEL_ASSERT(CIXEL_NULL != pallet || 0 == numColors);
+    CIXEL_ASSERT(0 <= numColors && numColors <= MAX_COLORS);
+    CIXEL_ASSERT(CIXEL_NULL != writeFunc);
+    CIXEL_ASSERT(CIXEL_NULL != indices);
+    Image image;
+    initImage(&image, indices, CIXEL_REINTERPRET_CAST(const Color*)(pallet), numColors, width, height);
+    Writer writer;
+    initWriter(&writer, encoder, writeFunc, userData, CIXEL_NULL, 0);
+    print(encoder, &writer, &image);
+}
+
+cixel_size_t cixelEncodeToMemory(CixelEncoder* encoder, const Pallet* pallet, cixel_u8* buffer, cixel_size_t capacity, const cixel_u8* CIXEL_RESTRICT indices)
+{
+    CIXEL_ASSERT(CIXEL_NULL != encoder);
+    CIXEL_ASSERT(CIXEL_NULL != pallet);
+    CIXEL_ASSERT(0 <= pallet->size_ && pallet->size_ <= MAX_COLORS);
+    CIXEL_ASSERT(CIXEL_NULL != buffer || 0 == capacity);
+    CIXEL_ASSERT(CIXEL_NULL != indices);
+    Image image;
+    initImage(&image, indices, pallet->colors_, pallet->size_, encoder->width_, encoder->height_);
+    Writer writer;
+    initWriter(&writer, encoder, CIXEL_NULL, CIXEL_NULL, buffer, capacity);
+    flush(&writer, 0, sizeof(header));
+    print(encoder, &writer, &image);
+    return writer.total_;
+}
+
+cixel_size_t cixelEncodeIndexedToMemory(CixelEncoder* encoder, cixel_s32 width, cixel_s32 height, const cixel_u32* pallet, cixel_s32 numColors, cixel_u8* buffer, cixel_size_t capacity, const cixel_u8* CIXEL_RESTRICT indices)
+{
+    CIXEL_ASSERT(CIXEL_NULL != encoder);
+    CIXEL_ASSERT(0 <= width && width <= encoder->width_);
+    CIXEL_ASSERT(0 <= height);
+    CIXEL_ASSERT(CIXEL_NULL != pallet || 0 == numColors);
+    CIXEL_ASSERT(0 <= numColors && numColors <= MAX_COLORS);
+    CIXEL_ASSERT(CIXEL_NULL != buffer || 0 == capacity);
+    CIXEL_ASSERT(CIXEL_NULL != indices);
+    Image image;
+    initImage(&image, indices, CIXEL_REINTERPRET_CAST(const Color*)(pallet), numColors, width, height);
+    Writer writer;
+    initWriter(&writer, encoder, CIXEL_NULL, CIXEL_NULL, buffer, capacity);
+    flush(&writer, 0, sizeof(header));
+    print(encoder, &writer, &image);
+    return writer.total_;
+}
+
 CIXEL_NAMESPACE_END(cixel)
 #endif // CIXEL_IMPLEMENTATION
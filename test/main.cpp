@@ -6,7 +6,4 @@
 #define STB_IMAGE_WRITE_IMPLEMENTATION
 #include "stb_image_write.h"
 
-#define CIXEL_IMPLEMENTATION
-#include "../cixel.h"
-
 UTEST_MAIN();
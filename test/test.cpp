@@ -1,11 +1,16 @@
+#include <algorithm>
 #include <chrono>
 #include <stdio.h>
+#include <string>
+#include <thread>
+#include <vector>
 
 #include "utest.h"
 
 #include "stb_image.h"
 #include "stb_image_write.h"
 
+#define CIXEL_IMPLEMENTATION
 #include "../cixel.h"
 
 namespace
@@ -47,6 +52,60 @@ namespace
         }
     }
 
+    void parallelFor(cixel::JobFunc job, void* args, cixel::cixel_s32 count, void* /*userData*/)
+    {
+        std::vector<std::thread> threads;
+        for(cixel::cixel_s32 i = 1; i < count; ++i) {
+            threads.emplace_back(job, args, i);
+        }
+        job(args, 0);
+        for(size_t i = 0; i < threads.size(); ++i) {
+            threads[i].join();
+        }
+    }
+
+    void parallelSequential(cixel::JobFunc job, void* args, cixel::cixel_s32 count, void* /*userData*/)
+    {
+        for(cixel::cixel_s32 i = 0; i < count; ++i) {
+            job(args, i);
+        }
+    }
+
+    cixel::cixel_u32* load(int* width, int* height, const char* src, const char* directory)
+    {
+        char buffer[128];
+        SPRINTF(buffer, "%s%s", directory, src);
+
+        int channels;
+        unsigned char* data = stbi_load(buffer, width, height, &channels, 0);
+        if(NULL == data) {
+            return NULL;
+        }
+        cixel::cixel_u32* pixels = convert(*width, *height, channels, data);
+        stbi_image_free(data);
+        return pixels;
+    }
+
+    bool sameQuantization(cixel::Cixel* cixel0, cixel::Cixel* cixel1, const cixel::cixel_u32* pixels, int size, bool flipVertical)
+    {
+        std::vector<cixel::cixel_u8> indices0(size);
+        std::vector<cixel::cixel_u8> indices1(size);
+        cixel::cixelQuantize(cixel0, &indices0[0], pixels, flipVertical);
+        cixel::cixelQuantize(cixel1, &indices1[0], pixels, flipVertical);
+        if(indices0 != indices1) {
+            return false;
+        }
+        if(cixel0->size_ != cixel1->size_) {
+            return false;
+        }
+        for(int i = 0; i < cixel0->size_; ++i) {
+            if(cixel::cixelGetPalletColor(cixel0, i).color_ != cixel::cixelGetPalletColor(cixel1, i).color_) {
+                return false;
+            }
+        }
+        return true;
+    }
+
     bool test(const char* src, const char* dst0, const char* dst1, const char* directory)
     {
         char buffer[128];
@@ -99,6 +158,142 @@ namespace
         cixel::cixelDestroy(cixel);
         return true;
     }
+
+    // Summed-area tables by inclusion-exclusion
+    void calcPrefixSumReference(cixel::cixel_u32* frequencies, cixel::Color32* accColors)
+    {
+        using namespace cixel;
+        for(cixel_s32 i = 1; i <= RESOLUTION_Y; ++i) {
+            cixel_s32 row1 = i * UV_PLANE_SIZE;
+            cixel_s32 row0 = row1 - UV_PLANE_SIZE;
+            for(cixel_s32 j = 1; j <= RESOLUTION_U; ++j) {
+                cixel_s32 col1 = j * V_SIZE;
+                cixel_s32 col0 = col1 - V_SIZE;
+                for(cixel_s32 k = 1; k <= RESOLUTION_V; ++k) {
+                    cixel_s32 dep1 = k;
+                    cixel_s32 dep0 = k - 1;
+                    cixel_s32 index = row1 + col1 + dep1;
+                    frequencies[index] += frequencies[row0 + col0 + dep0];
+                    frequencies[index] += frequencies[row0 + col1 + dep1];
+                    frequencies[index] += frequencies[row1 + col0 + dep1];
+                    frequencies[index] += frequencies[row1 + col1 + dep0];
+                    frequencies[index] -= frequencies[row0 + col0 + dep1];
+                    frequencies[index] -= frequencies[row0 + col1 + dep0];
+                    frequencies[index] -= frequencies[row1 + col0 + dep0];
+
+                    addColor32(&accColors[index], &accColors[row0 + col0 + dep0]);
+                    addColor32(&accColors[index], &accColors[row0 + col1 + dep1]);
+                    addColor32(&accColors[index], &accColors[row1 + col0 + dep1]);
+                    addColor32(&accColors[index], &accColors[row1 + col1 + dep0]);
+                    subColor32(&accColors[index], &accColors[row0 + col0 + dep1]);
+                    subColor32(&accColors[index], &accColors[row0 + col1 + dep0]);
+                    subColor32(&accColors[index], &accColors[row1 + col0 + dep0]);
+                }
+            }
+        }
+    }
+
+    // Squared distance from the center of a cell to a color
+    cixel::cixel_s32 getCellDistance(const cixel::Cixel* cixel, cixel::cixel_s32 index, cixel::cixel_s32 y, cixel::cixel_s32 u, cixel::cixel_s32 v)
+    {
+        using namespace cixel;
+        const Color* color = &cixel->colors_[index];
+        cixel_s32 dy = color->rgba_.r_ - ((y << SHIFT_Y) + (1 << (SHIFT_Y - 1)));
+        cixel_s32 du = color->rgba_.g_ - ((u << SHIFT_U) + (1 << (SHIFT_U - 1)));
+        cixel_s32 dv = color->rgba_.b_ - ((v << SHIFT_V) + (1 << (SHIFT_V - 1)));
+        return dy * dy + du * du + dv * dv;
+    }
+
+    // Decode sixels into indices, every pixel which is not drawn is left 0xFFFF
+    bool decodeSixel(std::vector<int>& indices, int width, int height, const std::vector<char>& sixel)
+    {
+        indices.assign(width * height, 0xFFFF);
+        size_t i = 0;
+        while(i < sixel.size() && 'q' != sixel[i]) {
+            ++i;
+        }
+        int x = 0;
+        int y = 0;
+        int color = 0;
+        for(++i; i < sixel.size();) {
+            char c = sixel[i++];
+            int run = 1;
+            if('"' == c || '#' == c) {
+                std::vector<int> numbers(1, 0);
+                while(i < sixel.size() && (';' == sixel[i] || ('0' <= sixel[i] && sixel[i] <= '9'))) {
+                    if(';' == sixel[i]) {
+                        numbers.push_back(0);
+                    } else {
+                        numbers.back() = numbers.back() * 10 + (sixel[i] - '0');
+                    }
+                    ++i;
+                }
+                if('#' == c) {
+                    color = numbers[0];
+                }
+                continue;
+            } else if('$' == c) {
+                x = 0;
+                continue;
+            } else if('-' == c) {
+                x = 0;
+                y += 6;
+                continue;
+            } else if(0x1B == c) {
+                return i < sixel.size() && 0x5C == sixel[i];
+            } else if('!' == c) {
+                run = 0;
+                while(i < sixel.size() && '0' <= sixel[i] && sixel[i] <= '9') {
+                    run = run * 10 + (sixel[i++] - '0');
+                }
+                c = sixel[i++];
+            }
+            if(c < '?' || '~' < c) {
+                return false;
+            }
+            for(int j = 0; j < run; ++j, ++x) {
+                for(int k = 0; k < 6; ++k) {
+                    if(0 == ((c - '?') & (1 << k))) {
+                        continue;
+                    }
+                    if(width <= x || height <= (y + k)) {
+                        return false;
+                    }
+                    indices[(y + k) * width + x] = color;
+                }
+            }
+        }
+        return false;
+    }
+
+    // Quantize noise, which takes all colors and does not compress
+    void quantizeNoise(cixel::Cixel* cixel, std::vector<cixel::cixel_u8>& indices, int width, int height)
+    {
+        std::vector<cixel::cixel_u32> pixels(width * height);
+        srand(13);
+        for(size_t i = 0; i < pixels.size(); ++i) {
+            pixels[i] = 0xFF000000U | ((rand() & 0xFFU) << 0) | ((rand() & 0xFFU) << 8) | ((rand() & 0xFFU) << 16);
+        }
+        indices.resize(width * height);
+        cixel::cixelQuantize(cixel, &indices[0], &pixels[0], false);
+    }
+
+    void writeVector(const void* data, cixel::cixel_size_t size, void* userData)
+    {
+        std::vector<char>* sixel = reinterpret_cast<std::vector<char>*>(userData);
+        const char* bytes = reinterpret_cast<const char*>(data);
+        sixel->insert(sixel->end(), bytes, bytes + size);
+    }
+
+    bool sameIndices(const std::vector<int>& decoded, const std::vector<cixel::cixel_u8>& indices)
+    {
+        for(size_t i = 0; i < indices.size(); ++i) {
+            if(decoded[i] != indices[i]) {
+                return false;
+            }
+        }
+        return true;
+    }
 } // namespace
 
 UTEST(Quantize_Encode, grad)
@@ -106,6 +301,997 @@ UTEST(Quantize_Encode, grad)
     EXPECT_TRUE(test("grad.png", "grad_out.jpg", "grad.txt", "../data/"));
 }
 
+UTEST(Convert, RGB2YUVRow)
+{
+    const int Size = 1037;
+    std::vector<cixel::cixel_u32> rgba(Size);
+    std::vector<cixel::cixel_u32> yuva0(Size);
+    std::vector<cixel::cixel_u32> yuva1(Size);
+    cixel::cixel_u32 x = 0x12345678U;
+    for(int i = 0; i < Size; ++i) {
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        rgba[i] = x;
+    }
+    rgba[0] = 0x00000000U;
+    rgba[1] = 0xFFFFFFFFU;
+    rgba[2] = 0xFF00FFFFU;
+    rgba[3] = 0xFFFF0000U;
+
+    cixel::cixelRGB2YUVRow(&yuva0[0], &rgba[0], Size);
+    int errors = 0;
+    for(int i = 0; i < Size; ++i) {
+        cixel::cixelRGB2YUVRow(&yuva1[i], &rgba[i], 1);
+        errors += (yuva0[i] != cixel::cixelRGB2YUV(rgba[i])) ? 1 : 0;
+    }
+    EXPECT_TRUE(yuva0 == yuva1);
+    EXPECT_EQ(0, errors);
+}
+
+static bool sameErrors(const std::vector<cixel::ColorS16>& x0, const std::vector<cixel::ColorS16>& x1)
+{
+    // Alpha of errors is not used, SIMD kernels diffuse it along with the others
+    for(size_t i = 0; i < x0.size(); ++i) {
+        if(x0[i].r_ != x1[i].r_ || x0[i].g_ != x1[i].g_ || x0[i].b_ != x1[i].b_) {
+            return false;
+        }
+    }
+    return x0.size() == x1.size();
+}
+
+UTEST(Convert, kernels)
+{
+    using namespace cixel;
+    // Every level of SIMD gives the same results as scalar, rows are not multiples of vectors
+    const cixel_s32 width = 203;
+    const cixel_s32 height = 16;
+    Cixel* cixel = cixelCreate(width, height, CIXEL_NULL, CIXEL_NULL);
+    std::vector<cixel_u8> indices;
+    quantizeNoise(cixel, indices, width, height);
+    std::vector<cixel_u32> rgba(width);
+    cixel_u32 x = 0x12345678U;
+    for(cixel_s32 i = 0; i < width; ++i) {
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        rgba[i] = x;
+    }
+    std::vector<cixel_s16> errors(4 * (width + 2));
+    for(size_t i = 0; i < errors.size(); ++i) {
+        errors[i] = static_cast<cixel_s16>((i * 37) % 97) - 48;
+    }
+
+    Kernels kernels[2];
+    selectKernels(&kernels[0], SIMD_Scalar);
+    std::vector<cixel_u32> yuva[2];
+    std::vector<cixel_u32> frequencies[2];
+    std::vector<Color32> accColors[2];
+    BoxU8 boxes[2];
+    std::vector<cixel_u8> dithered[4];
+    std::vector<ColorS16> current[4];
+    std::vector<ColorS16> next[4];
+    for(int simd = SIMD_Scalar; simd <= getSIMD(); ++simd) {
+        selectKernels(&kernels[1], static_cast<SIMD>(simd));
+        for(int k = 0; k < 2; ++k) {
+            yuva[k].assign(width, 0);
+            kernels[k].rgb2yuvRow_(&yuva[k][0], &rgba[0], width);
+
+            frequencies[k].assign(FREQUENCY_SIZE, 0);
+            accColors[k].assign(FREQUENCY_SIZE, Color32());
+            Histogram histogram;
+            histogram.frequencies_ = &frequencies[k][0];
+            histogram.accColors_ = &accColors[k][0];
+            resetBox(&histogram.box_);
+            kernels[k].accumulateRow_(&histogram, reinterpret_cast<const Color*>(&yuva[0][0]), width);
+            boxes[k] = histogram.box_;
+
+            for(int d = 0; d < 2; ++d) {
+                int n = k * 2 + d;
+                dithered[n].assign(width, 0);
+                current[n].assign(width + 2, ColorS16());
+                next[n].assign(width + 2, ColorS16());
+                memcpy(&current[n][0], &errors[0], sizeof(ColorS16) * (width + 2));
+                const Color* yuv = reinterpret_cast<const Color*>(&yuva[0][0]);
+                if(0 == d) {
+                    kernels[k].diffuseRight_(cixel, &dithered[n][0], yuv, &current[n][0], &next[n][0], 0, width);
+                } else {
+                    kernels[k].diffuseLeft_(cixel, &dithered[n][0], yuv, &current[n][0], &next[n][0], 0, width);
+                }
+            }
+        }
+        EXPECT_TRUE(yuva[0] == yuva[1]);
+        EXPECT_TRUE(frequencies[0] == frequencies[1]);
+        EXPECT_TRUE(0 == memcmp(&accColors[0][0], &accColors[1][0], sizeof(Color32) * FREQUENCY_SIZE));
+        EXPECT_TRUE(0 == memcmp(&boxes[0], &boxes[1], sizeof(BoxU8)));
+        for(int d = 0; d < 2; ++d) {
+            EXPECT_TRUE(dithered[d] == dithered[2 + d]);
+            EXPECT_TRUE(sameErrors(current[d], current[2 + d]));
+            EXPECT_TRUE(sameErrors(next[d], next[2 + d]));
+        }
+    }
+    cixelDestroy(cixel);
+}
+
+namespace
+{
+    struct ErrorS32
+    {
+        cixel::cixel_s32 e_[4];
+    };
+
+    void addError(ErrorS32* c, cixel::cixel_s32 ratio, const cixel::cixel_s32 error[3])
+    {
+        for(int i = 0; i < 3; ++i) {
+            c->e_[i] += ratio * error[i];
+        }
+    }
+
+    /**
+    @brief Floyd-Steinberg with a full frame of 32 bit errors, as diffusion did before rows of errors rolled
+    */
+    void diffuseFullFrame(const cixel::Cixel* cixel, std::vector<cixel::cixel_u8>& indices, bool serpentine)
+    {
+        using namespace cixel;
+        cixel_s32 width = cixel->width_;
+        cixel_s32 width2 = width + 2;
+        std::vector<ErrorS32> errors(width2 * (cixel->height_ + 1), ErrorS32());
+        indices.assign(width * cixel->height_, 0);
+        for(cixel_s32 y = 0; y < cixel->height_; ++y) {
+            ErrorS32* current = &errors[y * width2];
+            ErrorS32* next = current + width2;
+            bool right = !serpentine || 0 == (y & 0x01);
+            for(cixel_s32 i = 0; i < width; ++i) {
+                cixel_s32 x = right ? i : width - 1 - i;
+                const Color& yuv = cixel->yuv_[y * width + x];
+                cixel_s32 source[3] = {yuv.rgba_.r_, yuv.rgba_.g_, yuv.rgba_.b_};
+                cixel_s32 t[3];
+                for(int c = 0; c < 3; ++c) {
+                    t[c] = clamp((current[x + 1].e_[c] + (source[c] << 4)) >> 4, 0, 255);
+                }
+                cixel_s32 index = ((t[0] >> SHIFT_Y) << GRID_SHIFT_Y) + ((t[1] >> SHIFT_U) << GRID_SHIFT_U) + (t[2] >> SHIFT_V);
+                cixel_u8 nearest = static_cast<cixel_u8>(cixel->grid_[index]);
+                indices[y * width + x] = nearest;
+                const Color& color = cixel->colors_[nearest];
+                cixel_s32 error[3] = {source[0] - color.rgba_.r_, source[1] - color.rgba_.g_, source[2] - color.rgba_.b_};
+                addError(&current[x], K12YUV655, error);
+                addError(&next[x], right ? K22YUV655 : K20YUV655, error);
+                addError(&next[x + 1], K21YUV655, error);
+                addError(&next[x + 2], right ? K20YUV655 : K22YUV655, error);
+            }
+        }
+    }
+} // namespace
+
+UTEST(Quantize, rollingErrors)
+{
+    using namespace cixel;
+    // Two rolling rows of 16 bit errors give the same indices as a full frame of 32 bit errors
+    const cixel_s32 width = 157;
+    const cixel_s32 height = 61;
+    Cixel* cixel = cixelCreate(width, height, CIXEL_NULL, CIXEL_NULL);
+    std::vector<cixel_u32> pixels(width * height);
+    srand(7);
+    for(cixel_s32 y = 0; y < height; ++y) {
+        for(cixel_s32 x = 0; x < width; ++x) {
+            cixel_u32 r = static_cast<cixel_u32>(x * 255 / width);
+            cixel_u32 g = static_cast<cixel_u32>(y * 255 / height);
+            cixel_u32 b = static_cast<cixel_u32>(rand() & 0xFF);
+            pixels[y * width + x] = 0xFF000000U | (b << 16) | (g << 8) | r;
+        }
+    }
+    std::vector<cixel_u8> indices(width * height);
+    std::vector<cixel_u8> expected;
+
+    cixelSetDither(cixel, Dither_FloydSteinberg);
+    cixelQuantize(cixel, &indices[0], &pixels[0], false);
+    diffuseFullFrame(cixel, expected, true);
+    EXPECT_TRUE(indices == expected);
+
+    cixelSetDither(cixel, Dither_FloydSteinbergRaster);
+    cixelQuantize(cixel, &indices[0], &pixels[0], false);
+    diffuseFullFrame(cixel, expected, false);
+    EXPECT_TRUE(indices == expected);
+    cixelDestroy(cixel);
+}
+
+UTEST(Quantize, parallel)
+{
+    int width, height;
+    cixel::cixel_u32* pixels = load(&width, &height, "grad.png", "../data/");
+    ASSERT_TRUE(NULL != pixels);
+
+    cixel::Cixel* cixel0 = cixel::cixelCreate(width, height, CIXEL_NULL, CIXEL_NULL);
+    cixel::Cixel* cixel1 = cixel::cixelCreate(width, height, CIXEL_NULL, CIXEL_NULL);
+    EXPECT_TRUE(cixel::cixelSetParallel(cixel1, 4, parallelFor, CIXEL_NULL));
+    EXPECT_TRUE(sameQuantization(cixel0, cixel1, pixels, width * height, false));
+    EXPECT_TRUE(sameQuantization(cixel0, cixel1, pixels, width * height, true));
+
+    cixel::cixelDestroy(cixel1);
+    cixel::cixelDestroy(cixel0);
+    free(pixels);
+}
+
+UTEST(Quantize, ordered)
+{
+    int width, height;
+    cixel::cixel_u32* pixels = load(&width, &height, "grad.png", "../data/");
+    ASSERT_TRUE(NULL != pixels);
+
+    cixel::Cixel* cixel0 = cixel::cixelCreate(width, height, CIXEL_NULL, CIXEL_NULL);
+    cixel::Cixel* cixel1 = cixel::cixelCreate(width, height, CIXEL_NULL, CIXEL_NULL);
+    cixel::cixelSetDither(cixel0, cixel::Dither_Ordered);
+    cixel::cixelSetDither(cixel1, cixel::Dither_Ordered);
+    EXPECT_TRUE(cixel::cixelSetParallel(cixel1, 4, parallelFor, CIXEL_NULL));
+    EXPECT_TRUE(sameQuantization(cixel0, cixel1, pixels, width * height, false));
+
+    cixel::cixelDestroy(cixel1);
+    cixel::cixelDestroy(cixel0);
+    free(pixels);
+}
+
+UTEST(Quantize, wavefront)
+{
+    int width, height;
+    cixel::cixel_u32* pixels = load(&width, &height, "grad.png", "../data/");
+    ASSERT_TRUE(NULL != pixels);
+
+    cixel::Cixel* cixel0 = cixel::cixelCreate(width, height, CIXEL_NULL, CIXEL_NULL);
+    cixel::Cixel* cixel1 = cixel::cixelCreate(width, height, CIXEL_NULL, CIXEL_NULL);
+    cixel::cixelSetDither(cixel0, cixel::Dither_FloydSteinbergRaster);
+    cixel::cixelSetDither(cixel1, cixel::Dither_FloydSteinbergRaster);
+    EXPECT_TRUE(cixel::cixelSetParallel(cixel1, 4, parallelFor, CIXEL_NULL));
+    EXPECT_TRUE(sameQuantization(cixel0, cixel1, pixels, width * height, false));
+
+    // Jobs which do not run concurrently must not wait for each other
+    EXPECT_TRUE(cixel::cixelSetParallel(cixel1, 4, parallelSequential, CIXEL_NULL));
+    EXPECT_TRUE(sameQuantization(cixel0, cixel1, pixels, width * height, false));
+
+    cixel::cixelDestroy(cixel1);
+    cixel::cixelDestroy(cixel0);
+    free(pixels);
+}
+
+UTEST(Quantize, strips)
+{
+    int width, height;
+    cixel::cixel_u32* pixels = load(&width, &height, "grad.png", "../data/");
+    ASSERT_TRUE(NULL != pixels);
+
+    cixel::Cixel* cixel0 = cixel::cixelCreate(width, height, CIXEL_NULL, CIXEL_NULL);
+    cixel::Cixel* cixel1 = cixel::cixelCreate(width, height, CIXEL_NULL, CIXEL_NULL);
+    cixel::cixelSetDither(cixel0, cixel::Dither_FloydSteinbergStrips);
+    cixel::cixelSetDither(cixel1, cixel::Dither_FloydSteinbergStrips);
+    EXPECT_TRUE(cixel::cixelSetParallel(cixel1, 4, parallelFor, CIXEL_NULL));
+    EXPECT_TRUE(sameQuantization(cixel0, cixel1, pixels, width * height, false));
+
+    // The first strip has nothing above it, so it matches the whole frame diffusion
+    std::vector<cixel::cixel_u8> indices0(width * height);
+    std::vector<cixel::cixel_u8> indices1(width * height);
+    cixel::cixelQuantize(cixel1, &indices1[0], pixels, false);
+    cixel::cixelSetDither(cixel0, cixel::Dither_FloydSteinberg);
+    cixel::cixelQuantize(cixel0, &indices0[0], pixels, false);
+    EXPECT_TRUE(std::equal(indices0.begin(), indices0.begin() + width * cixel::STRIP_HEIGHT, indices1.begin()));
+
+    cixel::cixelDestroy(cixel1);
+    cixel::cixelDestroy(cixel0);
+    free(pixels);
+}
+
+UTEST(Quantize, reuse)
+{
+    int width, height;
+    cixel::cixel_u32* pixels = load(&width, &height, "grad.png", "../data/");
+    ASSERT_TRUE(NULL != pixels);
+
+    // Tables are cleared lazily, so a reused context has to match a fresh one
+    std::vector<cixel::cixel_u32> noise(width * height);
+    std::vector<cixel::cixel_u8> indices(width * height);
+    cixel::cixel_u32 x = 0x12345678U;
+    for(size_t i = 0; i < noise.size(); ++i) {
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        noise[i] = x | 0xFF000000U;
+    }
+    cixel::Cixel* cixel0 = cixel::cixelCreate(width, height, CIXEL_NULL, CIXEL_NULL);
+    cixel::Cixel* cixel1 = cixel::cixelCreate(width, height, CIXEL_NULL, CIXEL_NULL);
+    cixel::cixelQuantize(cixel0, &indices[0], &noise[0], false);
+    EXPECT_TRUE(sameQuantization(cixel0, cixel1, pixels, width * height, false));
+
+    cixel::cixelDestroy(cixel1);
+    cixel::cixelDestroy(cixel0);
+    free(pixels);
+}
+
+UTEST(Quantize, gridReuse)
+{
+    using namespace cixel;
+    // Dark colors after noise clear only their box of the grid, the rest keeps colors of the noise until it is filled again
+    const int width = 128;
+    const int height = 128;
+    std::vector<cixel_u32> noise(width * height);
+    std::vector<cixel_u32> dark(width * height);
+    cixel_u32 x = 0x12345678U;
+    for(size_t i = 0; i < noise.size(); ++i) {
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        noise[i] = x | 0xFF000000U;
+        dark[i] = (x & 0x001F1F3FU) | 0xFF000000U;
+    }
+    std::vector<cixel_u8> indices(width * height);
+    Cixel* cixel0 = cixelCreate(width, height, CIXEL_NULL, CIXEL_NULL);
+    Cixel* cixel1 = cixelCreate(width, height, CIXEL_NULL, CIXEL_NULL);
+    cixelQuantize(cixel0, &indices[0], &noise[0], false);
+    EXPECT_TRUE(sameQuantization(cixel0, cixel1, &dark[0], width * height, false));
+    EXPECT_LT(getVolume(&cixel0->gridBox_) * 8, GRID_SIZE);
+
+    // Clearing tables leaves the grid, every cell of which is valid
+    clearTables(cixel0);
+    int invalid = 0;
+    for(cixel_s32 i = 0; i < GRID_SIZE; ++i) {
+        invalid += (cixel0->grid_[i] < 0 || cixel0->size_ <= cixel0->grid_[i]) ? 1 : 0;
+    }
+    EXPECT_EQ(0, invalid);
+    cixelDestroy(cixel1);
+    cixelDestroy(cixel0);
+}
+
+UTEST(Quantize, sparse)
+{
+    int width, height;
+    cixel::cixel_u32* pixels = load(&width, &height, "grad.png", "../data/");
+    ASSERT_TRUE(NULL != pixels);
+
+    // Small images take the sparse path, which has to match summed-area tables
+    const int Size = 64;
+    std::vector<cixel::cixel_u32> crop(Size * Size);
+    std::vector<cixel::cixel_u32> noise(Size * Size);
+    cixel::cixel_u32 x = 0x12345678U;
+    for(int i = 0; i < Size; ++i) {
+        for(int j = 0; j < Size; ++j) {
+            crop[i * Size + j] = pixels[(i * 7) * width + j * 11];
+            x ^= x << 13;
+            x ^= x >> 17;
+            x ^= x << 5;
+            noise[i * Size + j] = x | 0xFF000000U;
+        }
+    }
+    cixel::Cixel* cixel0 = cixel::cixelCreate(Size, Size, CIXEL_NULL, CIXEL_NULL);
+    cixel::Cixel* cixel1 = cixel::cixelCreate(Size, Size, CIXEL_NULL, CIXEL_NULL);
+    cixel1->sparseLimit_ = 0;
+    EXPECT_TRUE(sameQuantization(cixel0, cixel1, &crop[0], Size * Size, false));
+    EXPECT_TRUE(cixel0->sparse_);
+    EXPECT_FALSE(cixel1->sparse_);
+    EXPECT_TRUE(sameQuantization(cixel0, cixel1, &noise[0], Size * Size, true));
+    EXPECT_TRUE(sameQuantization(cixel0, cixel1, &crop[0], Size * Size, false));
+
+    cixel::cixelDestroy(cixel1);
+    cixel::cixelDestroy(cixel0);
+    free(pixels);
+}
+
+UTEST(Quantize, exact)
+{
+    // Images of no more than 256 colors get an exact pallet
+    const int Width = 97;
+    const int Height = 41;
+    std::vector<cixel::cixel_u32> pixels(Width * Height);
+    std::vector<cixel::cixel_u8> indices(Width * Height);
+    cixel::cixel_u32 x = 0x12345678U;
+    for(int i = 0; i < Height; ++i) {
+        for(int j = 0; j < Width; ++j) {
+            x ^= x << 13;
+            x ^= x >> 17;
+            x ^= x << 5;
+            pixels[i * Width + j] = ((x & 0xFFU) * 0x00010307U) | 0xFF000000U;
+        }
+    }
+    cixel::Cixel* cixel = cixel::cixelCreate(Width, Height, CIXEL_NULL, CIXEL_NULL);
+    for(int flip = 0; flip < 2; ++flip) {
+        cixel::cixelQuantize(cixel, &indices[0], &pixels[0], 0 != flip);
+        EXPECT_EQ(256, cixel->size_);
+        bool same = true;
+        for(int i = 0; i < Height; ++i) {
+            int row = flip ? (Height - 1 - i) : i;
+            for(int j = 0; j < Width; ++j) {
+                same = same && (pixels[row * Width + j] == cixel->pallet_[indices[i * Width + j]].color_);
+            }
+        }
+        EXPECT_TRUE(same);
+    }
+
+    // One more color falls back to median cut
+    pixels[Width * Height / 2] = 0xFF123456U;
+    cixel::cixelQuantize(cixel, &indices[0], &pixels[0], false);
+    int mismatches = 0;
+    for(int i = 0; i < Width * Height; ++i) {
+        mismatches += (pixels[i] != cixel->pallet_[indices[i]].color_) ? 1 : 0;
+    }
+    EXPECT_LT(0, mismatches);
+    cixel::cixelDestroy(cixel);
+}
+
+UTEST(Quantize, maxColors)
+{
+    int width, height;
+    cixel::cixel_u32* pixels = load(&width, &height, "grad.png", "../data/");
+    ASSERT_TRUE(NULL != pixels);
+
+    std::vector<cixel::cixel_u8> indices(width * height);
+    cixel::Cixel* cixel = cixel::cixelCreate(width, height, CIXEL_NULL, CIXEL_NULL);
+    const cixel::cixel_s32 MaxColors[] = {16, 64, 1, 256};
+    for(size_t i = 0; i < sizeof(MaxColors) / sizeof(MaxColors[0]); ++i) {
+        cixel::cixelSetMaxColors(cixel, MaxColors[i]);
+        cixel::cixelQuantize(cixel, &indices[0], pixels, false);
+        EXPECT_LE(cixel->size_, MaxColors[i]);
+        cixel::cixel_u8 maxIndex = 0;
+        for(size_t j = 0; j < indices.size(); ++j) {
+            maxIndex = std::max(maxIndex, indices[j]);
+        }
+        EXPECT_LT(static_cast<cixel::cixel_s32>(maxIndex), cixel->size_);
+    }
+
+    cixel::cixelDestroy(cixel);
+    free(pixels);
+}
+
+UTEST(Quantize, heap)
+{
+    using namespace cixel;
+    // Buckets are popped in the order of a sort by priority
+    const cixel_s32 Size = 97;
+    std::vector<Bucket> heap(Size);
+    std::vector<cixel_u32> expected(Size);
+    cixel_u32 x = 0x2545F491U;
+    for(cixel_s32 i = 0; i < Size; ++i) {
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        Bucket bucket = {};
+        bucket.frequency_ = static_cast<cixel_u32>(i);
+        bucket.priority_ = x % 31; // with ties
+        pushHeap(&heap[0], i, &bucket);
+        expected[i] = bucket.priority_;
+    }
+    std::sort(expected.begin(), expected.end(), std::greater<cixel_u32>());
+    std::vector<bool> popped(Size, false);
+    int errors = 0;
+    for(cixel_s32 i = 0; i < Size; ++i) {
+        Bucket top;
+        popHeap(&heap[0], Size - i, &top);
+        errors += (expected[i] != top.priority_ || popped[top.frequency_]) ? 1 : 0;
+        popped[top.frequency_] = true;
+    }
+    EXPECT_EQ(0, errors);
+
+    // A cell of the histogram with more RGB values than maxColors cannot be split, and is retired as a color
+    const cixel_s32 width = 32;
+    const cixel_s32 height = 32;
+    const cixel_u32 base = 0xFF808080U;
+    std::vector<cixel_u32> values;
+    for(cixel_u32 i = 0; i < 512; ++i) {
+        cixel_u32 rgba = base + ((i & 0x07U) << 0) + (((i >> 3) & 0x07U) << 8) + (((i >> 6) & 0x07U) << 16);
+        if((cixelRGB2YUV(rgba) & 0xF8F8F8U) == (cixelRGB2YUV(base) & 0xF8F8F8U)) {
+            values.push_back(rgba);
+        }
+    }
+    ASSERT_LT(8, static_cast<int>(values.size()));
+    std::vector<cixel_u32> pixels(width * height);
+    for(size_t i = 0; i < pixels.size(); ++i) {
+        pixels[i] = values[i % values.size()];
+    }
+    std::vector<cixel_u8> indices(width * height, 0xFFU);
+    Cixel* cixel = cixelCreate(width, height, CIXEL_NULL, CIXEL_NULL);
+    cixelSetMaxColors(cixel, 4);
+    const cixel_s32 SparseLimits[] = {cixel->sparseLimit_, 0};
+    for(int i = 0; i < 2; ++i) {
+        cixel->sparseLimit_ = SparseLimits[i];
+        cixelQuantize(cixel, &indices[0], &pixels[0], false);
+        EXPECT_EQ(1, cixel->size_);
+        EXPECT_TRUE(std::count(indices.begin(), indices.end(), 0) == static_cast<std::ptrdiff_t>(indices.size()));
+    }
+    cixelDestroy(cixel);
+}
+
+namespace
+{
+    cixel::cixel_u32 volumePriority(const cixel::BoxU8* box, cixel::cixel_u32 frequency)
+    {
+        return frequency * static_cast<cixel::cixel_u32>(cixel::getVolume(box));
+    }
+
+    /**
+    @brief Number of colors of the pallet in a box of YUV
+    */
+    int countColorsIn(const cixel::Cixel* cixel, const cixel::Color& lower, const cixel::Color& upper)
+    {
+        int count = 0;
+        for(cixel::cixel_s32 i = 0; i < cixel->size_; ++i) {
+            const cixel::Color& c = cixel->colors_[i];
+            bool inside = lower.rgba_.r_ <= c.rgba_.r_ && c.rgba_.r_ <= upper.rgba_.r_
+                          && lower.rgba_.g_ <= c.rgba_.g_ && c.rgba_.g_ <= upper.rgba_.g_
+                          && lower.rgba_.b_ <= c.rgba_.b_ && c.rgba_.b_ <= upper.rgba_.b_;
+            count += inside ? 1 : 0;
+        }
+        return count;
+    }
+} // namespace
+
+UTEST(Quantize, priority)
+{
+    using namespace cixel;
+    // Most pixels are in a small dark region, and a few are scattered over all colors
+    const cixel_s32 width = 64;
+    const cixel_s32 height = 64;
+    std::vector<cixel_u32> pixels(width * height);
+    Color lower;
+    Color upper;
+    lower.color_ = 0xFFFFFFFFU;
+    upper.color_ = 0;
+    srand(11);
+    for(cixel_s32 y = 0; y < height; ++y) {
+        for(cixel_s32 x = 0; x < width; ++x) {
+            cixel_u32 rgba;
+            if(0 == ((x * 7 + y * 13) & 0x1F)) {
+                rgba = static_cast<cixel_u32>(rand() & 0xFF) | (static_cast<cixel_u32>(rand() & 0xFF) << 8) | (static_cast<cixel_u32>(rand() & 0xFF) << 16);
+            } else {
+                rgba = static_cast<cixel_u32>(x) | (static_cast<cixel_u32>(y) << 8) | (0x20U << 16);
+                Color yuv;
+                yuv.color_ = cixelRGB2YUV(0xFF000000U | rgba);
+                lower.rgba_.r_ = std::min(lower.rgba_.r_, yuv.rgba_.r_);
+                lower.rgba_.g_ = std::min(lower.rgba_.g_, yuv.rgba_.g_);
+                lower.rgba_.b_ = std::min(lower.rgba_.b_, yuv.rgba_.b_);
+                upper.rgba_.r_ = std::max(upper.rgba_.r_, yuv.rgba_.r_);
+                upper.rgba_.g_ = std::max(upper.rgba_.g_, yuv.rgba_.g_);
+                upper.rgba_.b_ = std::max(upper.rgba_.b_, yuv.rgba_.b_);
+            }
+            pixels[y * width + x] = 0xFF000000U | rgba;
+        }
+    }
+    std::vector<cixel_u8> indices(width * height);
+    Cixel* cixel = cixelCreate(width, height, CIXEL_NULL, CIXEL_NULL);
+    cixelSetMaxColors(cixel, 16);
+
+    cixelQuantize(cixel, &indices[0], &pixels[0], false);
+    EXPECT_LE(cixel->size_, cixel->maxColors_);
+    int frequencyInside = countColorsIn(cixel, lower, upper);
+    std::vector<Color> frequencyColors(cixel->colors_, cixel->colors_ + cixel->size_);
+
+    // Weighting by volume splits the large sparse boxes instead of the dense small ones
+    cixelSetPriority(cixel, volumePriority);
+    cixelQuantize(cixel, &indices[0], &pixels[0], false);
+    EXPECT_LE(cixel->size_, cixel->maxColors_);
+    EXPECT_LT(countColorsIn(cixel, lower, upper), frequencyInside);
+
+    // CIXEL_NULL is the frequency again
+    cixelSetPriority(cixel, CIXEL_NULL);
+    cixelQuantize(cixel, &indices[0], &pixels[0], false);
+    ASSERT_EQ(static_cast<cixel_s32>(frequencyColors.size()), cixel->size_);
+    EXPECT_TRUE(0 == memcmp(&frequencyColors[0], cixel->colors_, sizeof(Color) * cixel->size_));
+    cixelDestroy(cixel);
+}
+
+UTEST(Quantize, prefixSum)
+{
+    using namespace cixel;
+    Cixel* cixel = cixelCreate(16, 16, CIXEL_NULL, CIXEL_NULL);
+    std::vector<cixel_u32> frequencies(FREQUENCY_SIZE);
+    std::vector<Color32> accColors(FREQUENCY_SIZE);
+    cixel_u32 x = 0x12345678U;
+    for(cixel_s32 i = 1; i <= RESOLUTION_Y; ++i) {
+        for(cixel_s32 j = 1; j <= RESOLUTION_U; ++j) {
+            for(cixel_s32 k = 1; k <= RESOLUTION_V; ++k) {
+                x ^= x << 13;
+                x ^= x >> 17;
+                x ^= x << 5;
+                cixel_s32 index = i * UV_PLANE_SIZE + j * V_SIZE + k;
+                frequencies[index] = x & 0xFFU;
+                Color32 color = {x, x >> 8, x >> 16, 0};
+                accColors[index] = color;
+            }
+        }
+    }
+    std::vector<cixel_u32> frequencies0 = frequencies;
+    std::vector<Color32> accColors0 = accColors;
+    calcPrefixSumReference(&frequencies0[0], &accColors0[0]);
+
+    BoxU8 box = {{0, 0, 0, 0}, {RESOLUTION_Y - 1, RESOLUTION_U - 1, RESOLUTION_V - 1, 0}};
+    for(int simd = SIMD_Scalar; simd <= getSIMD(); ++simd) {
+        selectKernels(&cixel->kernels_, static_cast<SIMD>(simd));
+        memcpy(cixel->frequencies_, &frequencies[0], sizeof(cixel_u32) * FREQUENCY_SIZE);
+        memcpy(cixel->accColors_, &accColors[0], sizeof(Color32) * FREQUENCY_SIZE);
+        calcPrefixSum(cixel, &box);
+        EXPECT_EQ(0, memcmp(cixel->frequencies_, &frequencies0[0], sizeof(cixel_u32) * FREQUENCY_SIZE));
+        EXPECT_EQ(0, memcmp(cixel->accColors_, &accColors0[0], sizeof(Color32) * FREQUENCY_SIZE));
+    }
+    cixelDestroy(cixel);
+}
+
+UTEST(Quantize, grid)
+{
+    using namespace cixel;
+    Cixel* cixel = cixelCreate(16, 16, CIXEL_NULL, CIXEL_NULL);
+    cixel_u32 x = 0x12345678U;
+    cixel->size_ = 40;
+    for(cixel_s32 i = 0; i < cixel->size_; ++i) {
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        cixel->colors_[i].color_ = x | 0xFF000000U;
+    }
+    // A box covers some cells, the others are filled with the nearest colors
+    BoxU8 box = {{4, 5, 6, 0}, {9, 20, 11, 0}};
+    for(int simd = SIMD_Scalar; simd <= getSIMD(); ++simd) {
+        selectKernels(&cixel->kernels_, static_cast<SIMD>(simd));
+        memset(cixel->grid_, -1, sizeof(cixel_s16) * GRID_SIZE);
+        cixel->gridBox_ = box;
+        for(cixel_s32 y = box.start_.x_; y <= box.end_.x_; ++y) {
+            for(cixel_s32 u = box.start_.y_; u <= box.end_.y_; ++u) {
+                for(cixel_s32 v = box.start_.z_; v <= box.end_.z_; ++v) {
+                    cixel->grid_[(y << GRID_SHIFT_Y) + (u << GRID_SHIFT_U) + v] = 7;
+                }
+            }
+        }
+        fillGrid(cixel);
+        int invalid = 0;
+        int farther = 0;
+        for(cixel_s32 y = 0; y < RESOLUTION_Y; ++y) {
+            for(cixel_s32 u = 0; u < RESOLUTION_U; ++u) {
+                for(cixel_s32 v = 0; v < RESOLUTION_V; ++v) {
+                    cixel_s32 index = cixel->grid_[(y << GRID_SHIFT_Y) + (u << GRID_SHIFT_U) + v];
+                    bool covered = box.start_.x_ <= y && y <= box.end_.x_ && box.start_.y_ <= u && u <= box.end_.y_ && box.start_.z_ <= v && v <= box.end_.z_;
+                    if(covered) {
+                        invalid += (7 != index) ? 1 : 0;
+                        continue;
+                    }
+                    if(index < 0 || cixel->size_ <= index) {
+                        ++invalid;
+                        continue;
+                    }
+                    cixel_s32 nearest = getCellDistance(cixel, 0, y, u, v);
+                    for(cixel_s32 i = 1; i < cixel->size_; ++i) {
+                        nearest = minimum(nearest, getCellDistance(cixel, i, y, u, v));
+                    }
+                    farther += (nearest < getCellDistance(cixel, index, y, u, v)) ? 1 : 0;
+                }
+            }
+        }
+        EXPECT_EQ(0, invalid);
+        EXPECT_EQ(0, farther);
+    }
+    cixelDestroy(cixel);
+}
+
+UTEST(Create, inPlace)
+{
+    // A workspace of the caller is not aligned, and is not freed
+    const int width = 300;
+    const int height = 200;
+    cixel::cixel_size_t size = cixel::cixelGetWorkspaceSize(width, height, cixel::Option_None);
+    std::vector<cixel::cixel_u8> workspace(size + 3);
+    EXPECT_TRUE(CIXEL_NULL == cixel::cixelCreateInPlace(&workspace[3], size - 1, width, height, cixel::Option_None, CIXEL_NULL, CIXEL_NULL));
+    cixel::Cixel* cixel0 = cixel::cixelCreateInPlace(&workspace[3], size, width, height, cixel::Option_None, CIXEL_NULL, CIXEL_NULL);
+    ASSERT_TRUE(CIXEL_NULL != cixel0);
+    EXPECT_TRUE(&workspace[3] <= reinterpret_cast<cixel::cixel_u8*>(cixel0));
+    cixel::Cixel* cixel1 = cixel::cixelCreate(width, height, CIXEL_NULL, CIXEL_NULL);
+
+    std::vector<cixel::cixel_u8> indices0;
+    std::vector<cixel::cixel_u8> indices1;
+    quantizeNoise(cixel0, indices0, width, height);
+    quantizeNoise(cixel1, indices1, width, height);
+    EXPECT_TRUE(indices0 == indices1);
+    std::vector<char> sixel0;
+    std::vector<char> sixel1;
+    EXPECT_TRUE(cixel::cixelSetParallel(cixel0, 2, parallelFor, CIXEL_NULL));
+    cixel::cixelPrintTo(cixel0, writeVector, &sixel0, &indices0[0]);
+    cixel::cixelPrintTo(cixel1, writeVector, &sixel1, &indices1[0]);
+    EXPECT_TRUE(sixel0 == sixel1);
+    cixel::cixelDestroy(cixel0);
+    cixel::cixelDestroy(cixel1);
+}
+
+UTEST(Create, resize)
+{
+    // A resized context gives the same sixels as a new one, and moves only when it grows beyond its workspace
+    const int sizes[][2] = {{64, 40}, {300, 200}, {120, 301}, {300, 200}, {640, 480}};
+    cixel::Cixel* cixel = cixel::cixelCreate(sizes[0][0], sizes[0][1], CIXEL_NULL, CIXEL_NULL);
+    EXPECT_TRUE(cixel::cixelSetParallel(cixel, 2, parallelFor, CIXEL_NULL));
+    for(size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i) {
+        int width = sizes[i][0];
+        int height = sizes[i][1];
+        cixel::cixel_size_t capacity = cixel->capacity_;
+        cixel::Cixel* resized = cixel::cixelResize(cixel, width, height);
+        ASSERT_TRUE(CIXEL_NULL != resized);
+        if(cixel::cixelGetWorkspaceSize(width, height, cixel::Option_None) <= capacity) {
+            EXPECT_TRUE(cixel == resized);
+        }
+        cixel = resized;
+        cixel::Cixel* expected = cixel::cixelCreate(width, height, CIXEL_NULL, CIXEL_NULL);
+
+        std::vector<cixel::cixel_u8> indices0;
+        std::vector<cixel::cixel_u8> indices1;
+        quantizeNoise(cixel, indices0, width, height);
+        quantizeNoise(expected, indices1, width, height);
+        EXPECT_TRUE(indices0 == indices1);
+        std::vector<char> sixel0;
+        std::vector<char> sixel1;
+        cixel::cixelPrintTo(cixel, writeVector, &sixel0, &indices0[0]);
+        cixel::cixelPrintTo(expected, writeVector, &sixel1, &indices1[0]);
+        EXPECT_TRUE(sixel0 == sixel1);
+        cixel::cixelDestroy(expected);
+    }
+    EXPECT_EQ(2, cixel->numThreads_);
+    cixel::cixelDestroy(cixel);
+
+    // A workspace of the caller cannot grow
+    cixel::cixel_size_t size = cixel::cixelGetWorkspaceSize(100, 100, cixel::Option_None);
+    std::vector<cixel::cixel_u8> workspace(size);
+    cixel = cixel::cixelCreateInPlace(&workspace[0], size, 100, 100, cixel::Option_None, CIXEL_NULL, CIXEL_NULL);
+    EXPECT_TRUE(cixel == cixel::cixelResize(cixel, 50, 100));
+    EXPECT_TRUE(CIXEL_NULL == cixel::cixelResize(cixel, 200, 100));
+    EXPECT_EQ(50, cixel->width_);
+    cixel::cixelDestroy(cixel);
+}
+
+UTEST(Create, roles)
+{
+    // A quantizer and an encoder need less than a context of both, and give the same sixels
+    const int width = 640;
+    const int height = 480;
+    cixel::cixel_size_t both = cixel::cixelGetWorkspaceSize(width, height, cixel::Option_None);
+    cixel::cixel_size_t quantizer = cixel::cixelGetWorkspaceSize(width, height, cixel::Option_QuantizeOnly);
+    cixel::cixel_size_t encoder = cixel::cixelEncoderGetWorkspaceSize(width, height);
+    EXPECT_LT(quantizer, both);
+    EXPECT_LT(encoder * 10, both);
+
+    cixel::Cixel* cixel0 = cixel::cixelCreate(width, height, CIXEL_NULL, CIXEL_NULL);
+    cixel::Cixel* cixel1 = cixel::cixelCreateWithOptions(width, height, cixel::Option_QuantizeOnly, CIXEL_NULL, CIXEL_NULL);
+    EXPECT_TRUE(cixel::cixelSetParallel(cixel1, 2, parallelFor, CIXEL_NULL));
+    std::vector<cixel::cixel_u8> workspace(encoder);
+    EXPECT_TRUE(CIXEL_NULL == cixel::cixelEncoderCreateInPlace(&workspace[0], encoder - 1, width, height, CIXEL_NULL, CIXEL_NULL));
+    cixel::CixelEncoder* encoder1 = cixel::cixelEncoderCreateInPlace(&workspace[0], encoder, width, height, CIXEL_NULL, CIXEL_NULL);
+    ASSERT_TRUE(CIXEL_NULL != encoder1);
+
+    std::vector<cixel::cixel_u8> indices0;
+    std::vector<cixel::cixel_u8> indices1;
+    quantizeNoise(cixel0, indices0, width, height);
+    quantizeNoise(cixel1, indices1, width, height);
+    EXPECT_TRUE(indices0 == indices1);
+    std::vector<char> sixel0;
+    std::vector<char> sixel1;
+    cixel::cixelPrintTo(cixel0, writeVector, &sixel0, &indices0[0]);
+    cixel::Pallet pallet;
+    cixel::cixelGetPallet(cixel1, &pallet);
+    cixel::cixelEncode(encoder1, &pallet, writeVector, &sixel1, &indices1[0]);
+    EXPECT_TRUE(sixel0 == sixel1);
+    cixel::cixelEncoderDestroy(encoder1);
+    cixel::cixelDestroy(cixel1);
+    cixel::cixelDestroy(cixel0);
+}
+
+UTEST(Encode, stream)
+{
+    // Output of noise is much larger than the buffer, which is written out many times
+    const int width = 700;
+    const int height = 301;
+    cixel::Cixel* cixel = cixel::cixelCreate(width, height, CIXEL_NULL, CIXEL_NULL);
+    std::vector<cixel::cixel_u8> indices;
+    quantizeNoise(cixel, indices, width, height);
+
+    FILE* file = tmpfile();
+    ASSERT_TRUE(NULL != file);
+    cixel::cixelPrint(cixel, file, &indices[0]);
+    std::vector<char> sixel(ftell(file));
+    rewind(file);
+    EXPECT_EQ(sixel.size(), fread(&sixel[0], 1, sixel.size(), file));
+    fclose(file);
+    EXPECT_LT(static_cast<size_t>(cixel->encoder_.writeBufferSize_) * 4, sixel.size());
+
+    std::vector<int> decoded;
+    EXPECT_TRUE(decodeSixel(decoded, width, height, sixel));
+    EXPECT_TRUE(sameIndices(decoded, indices));
+    cixel::cixelDestroy(cixel);
+}
+
+UTEST(Encode, sink)
+{
+    const int width = 300;
+    const int height = 200;
+    cixel::Cixel* cixel = cixel::cixelCreate(width, height, CIXEL_NULL, CIXEL_NULL);
+    std::vector<cixel::cixel_u8> indices;
+    quantizeNoise(cixel, indices, width, height);
+
+    std::vector<char> sixel;
+    cixel::cixelPrintTo(cixel, writeVector, &sixel, &indices[0]);
+    std::vector<int> decoded;
+    EXPECT_TRUE(decodeSixel(decoded, width, height, sixel));
+    EXPECT_TRUE(sameIndices(decoded, indices));
+
+    // Any capacity gets the size of the whole, and a prefix of the same bytes
+    EXPECT_EQ(sixel.size(), cixel::cixelPrintToMemory(cixel, CIXEL_NULL, 0, &indices[0]));
+    const size_t capacities[] = {sixel.size() + 16, sixel.size(), sixel.size() - 1, sixel.size() / 3, 100, 5};
+    for(size_t i = 0; i < sizeof(capacities) / sizeof(capacities[0]); ++i) {
+        std::vector<char> memory(capacities[i] + 16, 'x');
+        cixel::cixel_size_t size = cixel::cixelPrintToMemory(cixel, reinterpret_cast<cixel::cixel_u8*>(&memory[0]), capacities[i], &indices[0]);
+        EXPECT_EQ(sixel.size(), size);
+        size_t count = std::min(capacities[i], sixel.size());
+        EXPECT_TRUE(std::equal(sixel.begin(), sixel.begin() + count, memory.begin()));
+        EXPECT_EQ(static_cast<size_t>(memory.size() - count), static_cast<size_t>(std::count(memory.begin() + count, memory.end(), 'x')));
+    }
+    cixel::cixelDestroy(cixel);
+}
+
+UTEST(Encode, parallel)
+{
+    // Bands are not divisible by threads, and the last band is not full
+    const int width = 400;
+    const int height = 301;
+    cixel::Cixel* cixel = cixel::cixelCreate(width, height, CIXEL_NULL, CIXEL_NULL);
+    std::vector<cixel::cixel_u8> indices;
+    quantizeNoise(cixel, indices, width, height);
+
+    std::vector<char> sixel0;
+    cixel::cixelPrintTo(cixel, writeVector, &sixel0, &indices[0]);
+    EXPECT_TRUE(cixel::cixelSetParallel(cixel, 3, parallelFor, CIXEL_NULL));
+    std::vector<char> sixel1;
+    cixel::cixelPrintTo(cixel, writeVector, &sixel1, &indices[0]);
+    EXPECT_TRUE(sixel0 == sixel1);
+
+    std::vector<char> sixel2(sixel0.size());
+    EXPECT_EQ(sixel0.size(), cixel::cixelPrintToMemory(cixel, reinterpret_cast<cixel::cixel_u8*>(&sixel2[0]), sixel2.size(), &indices[0]));
+    EXPECT_TRUE(sixel0 == sixel2);
+    cixel::cixelDestroy(cixel);
+}
+
+UTEST(Encode, pipeline)
+{
+    // A frame is encoded with a copy of its pallet while the next frame is quantized
+    const int width = 320;
+    const int height = 97;
+    cixel::Cixel* cixel = cixel::cixelCreate(width, height, CIXEL_NULL, CIXEL_NULL);
+    cixel::CixelEncoder* encoder = cixel::cixelEncoderCreate(width, height, CIXEL_NULL, CIXEL_NULL);
+    EXPECT_TRUE(cixel::cixelEncoderSetParallel(encoder, 2, parallelFor, CIXEL_NULL));
+    std::vector<cixel::cixel_u8> indices0;
+    quantizeNoise(cixel, indices0, width, height);
+    std::vector<char> expected;
+    cixel::cixelPrintTo(cixel, writeVector, &expected, &indices0[0]);
+    cixel::Pallet pallet;
+    cixel::cixelGetPallet(cixel, &pallet);
+
+    std::vector<char> sixel;
+    std::thread thread(cixel::cixelEncode, encoder, &pallet, writeVector, &sixel, &indices0[0]);
+    std::vector<cixel::cixel_u32> pixels(width * height);
+    for(int i = 0; i < height; ++i) {
+        for(int j = 0; j < width; ++j) {
+            pixels[i * width + j] = 0xFF000000U | ((j & 0xFFU) << 8) | (((i * 2) & 0xFFU) << 16);
+        }
+    }
+    std::vector<cixel::cixel_u8> indices1(width * height);
+    cixel::cixelQuantize(cixel, &indices1[0], &pixels[0], false);
+    thread.join();
+    EXPECT_TRUE(expected == sixel);
+
+    std::vector<char> sixel1;
+    cixel::cixelPrintTo(cixel, writeVector, &sixel1, &indices1[0]);
+    cixel::cixelGetPallet(cixel, &pallet);
+    std::vector<char> sixel2(sixel1.size());
+    EXPECT_EQ(sixel1.size(), cixel::cixelEncodeToMemory(encoder, &pallet, reinterpret_cast<cixel::cixel_u8*>(&sixel2[0]), sixel2.size(), &indices1[0]));
+    EXPECT_TRUE(sixel1 == sixel2);
+    cixel::cixelEncoderDestroy(encoder);
+    cixel::cixelDestroy(cixel);
+}
+
+UTEST(Encode, indexed)
+{
+    // Indices of a source narrower than the encoder, with a pallet of the caller
+    const int width = 250;
+    const int height = 133;
+    const cixel::cixel_u32 pallet[] = {0xFF000000U, 0xFFFFFFFFU, 0x000000FFU, 0xFF00FF00U, 0xFFFF0000U};
+    std::vector<cixel::cixel_u8> indices(width * height);
+    srand(5);
+    for(size_t i = 0; i < indices.size(); ++i) {
+        indices[i] = static_cast<cixel::cixel_u8>(rand() % 5);
+    }
+    cixel::CixelEncoder* encoder = cixel::cixelEncoderCreate(400, 20, CIXEL_NULL, CIXEL_NULL);
+    std::vector<char> sixel;
+    cixel::cixelEncodeIndexed(encoder, width, height, pallet, 5, writeVector, &sixel, &indices[0]);
+    std::vector<int> decoded;
+    EXPECT_TRUE(decodeSixel(decoded, width, height, sixel));
+    EXPECT_TRUE(sameIndices(decoded, indices));
+    std::string text(sixel.begin(), sixel.end());
+    EXPECT_NE(std::string::npos, text.find("#1;2;99;99;99#2;2;99;0;0"));
+
+    EXPECT_TRUE(cixel::cixelEncoderSetParallel(encoder, 3, parallelFor, CIXEL_NULL));
+    std::vector<char> sixel1(sixel.size());
+    EXPECT_EQ(sixel.size(), cixel::cixelEncodeIndexedToMemory(encoder, width, height, pallet, 5, reinterpret_cast<cixel::cixel_u8*>(&sixel1[0]), sixel1.size(), &indices[0]));
+    EXPECT_TRUE(sixel == sixel1);
+    cixel::cixelEncoderDestroy(encoder);
+}
+
+UTEST(Encode, span)
+{
+    // A small color on a background, passes of which are not written beyond the color
+    const int width = 600;
+    const int height = 40;
+    cixel::Cixel* cixel = cixel::cixelCreate(width, height, CIXEL_NULL, CIXEL_NULL);
+    std::vector<cixel::cixel_u32> pixels(width * height, 0xFF202020U);
+    for(int i = 3; i < 29; ++i) {
+        for(int j = 300; j < 310; ++j) {
+            pixels[i * width + j] = 0xFF00FFFFU;
+        }
+    }
+    std::vector<cixel::cixel_u8> indices(width * height);
+    cixel::cixelQuantize(cixel, &indices[0], &pixels[0], false);
+    EXPECT_EQ(2, cixel->size_);
+
+    std::vector<char> sixel;
+    cixel::cixelPrintTo(cixel, writeVector, &sixel, &indices[0]);
+    std::vector<int> decoded;
+    EXPECT_TRUE(decodeSixel(decoded, width, height, sixel));
+    EXPECT_TRUE(sameIndices(decoded, indices));
+
+    std::string text(sixel.begin(), sixel.end());
+    EXPECT_EQ(std::string::npos, text.find("?$"));
+    EXPECT_EQ(std::string::npos, text.find("?-"));
+    EXPECT_NE(std::string::npos, text.find("!300?"));
+    cixel::cixelDestroy(cixel);
+}
+
+UTEST(Encode, writeNumber)
+{
+    using namespace cixel;
+    const cixel_s32 numbers[] = {0, 7, 10, 99, 100, 255, 999, 1000, 4000, 9999, 10000, 65535, 123456789, 2147483647};
+    for(size_t i = 0; i < sizeof(numbers) / sizeof(numbers[0]); ++i) {
+        char expected[16];
+        SPRINTF(expected, "%s%d", "", numbers[i]);
+        cixel_u8 str[16];
+        cixel_s32 pos = writeNumber(1, str, numbers[i]);
+        EXPECT_EQ(static_cast<cixel_s32>(strlen(expected)) + 1, pos);
+        EXPECT_TRUE(0 == memcmp(expected, str + 1, strlen(expected)));
+    }
+
+    // A wide run is a single repeat
+    cixel_u8 str[16];
+    cixel_s32 pos = writeBits(0, str, 4000, 0x3F);
+    EXPECT_EQ(6, pos);
+    EXPECT_TRUE(0 == memcmp("!4000~", str, 6));
+}
+
+UTEST(Encode, buildSixels)
+{
+    using namespace cixel;
+    // Columns are not multiples of vectors, and a range does not begin at a vector
+    const cixel_s32 width = 77;
+    std::vector<cixel_u8> indices(width * 6);
+    srand(7);
+    for(size_t i = 0; i < indices.size(); ++i) {
+        indices[i] = static_cast<cixel_u8>(rand() % 5);
+    }
+    Kernels kernels;
+    std::vector<cixel_u8> sixels(width);
+    for(int simd = SIMD_Scalar; simd <= getSIMD(); ++simd) {
+        selectKernels(&kernels, static_cast<SIMD>(simd));
+        int errors = 0;
+        for(cixel_s32 rows = 1; rows <= 6; ++rows) {
+            for(cixel_s32 color = 0; color < 5; ++color) {
+                std::fill(sixels.begin(), sixels.end(), 0xFF);
+                kernels.buildSixels_(&sixels[0], &indices[0], width, rows, static_cast<cixel_u8>(color), 3, width);
+                errors += (0xFF != sixels[0] || 0xFF != sixels[2]) ? 1 : 0;
+                for(cixel_s32 k = 3; k < width; ++k) {
+                    cixel_u8 bits = 0;
+                    for(cixel_s32 j = 0; j < rows; ++j) {
+                        bits |= (color == indices[width * j + k]) ? (1 << j) : 0;
+                    }
+                    errors += (bits != sixels[k]) ? 1 : 0;
+                }
+            }
+        }
+        EXPECT_EQ(0, errors);
+    }
+}
+
 #if 0
 UTEST(Quantize_Encode, snake)
 {